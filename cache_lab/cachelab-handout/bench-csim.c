@@ -0,0 +1,71 @@
+/*
+ * bench-csim.c - Report wall time and peak RSS of a csim run
+ *
+ * Runs the given command -r times (default 5) with its output discarded
+ * and prints the best and mean wall time and the largest resident set
+ * size any run reached, e.g.
+ *
+ *     ./bench-csim -r 3 ./csim -s 20 -E 16 -b 6 -t traces/yi.trace
+ */
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char* argv[])
+{
+    int reps = 5, first = 1;
+    double best = 1e30, sum = 0;
+    long maxrss = 0;
+
+    if(argc > 2 && argv[1][0] == '-' && argv[1][1] == 'r'){
+        reps = atoi(argv[2]);
+        first = 3;
+    }
+    if(first >= argc || reps < 1){
+        printf("Usage: %s [-r reps] <command> [args...]\n", argv[0]);
+        return 1;
+    }
+
+    for(int i=0;i<reps;i++){
+        struct rusage ru;
+        int status;
+        double start = now();
+        pid_t pid = fork();
+        if(pid == 0){
+            int devnull = open("/dev/null", O_WRONLY);
+            dup2(devnull, STDOUT_FILENO);
+            execv(argv[first], argv + first);
+            _exit(127);
+        }
+        if(pid < 0 || wait4(pid, &status, 0, &ru) < 0){
+            perror("bench-csim");
+            return 1;
+        }
+        double elapsed = now() - start;
+        if(!WIFEXITED(status) || WEXITSTATUS(status) != 0){
+            printf("%s failed\n", argv[first]);
+            return 1;
+        }
+        if(elapsed < best) best = elapsed;
+        sum += elapsed;
+        if(ru.ru_maxrss > maxrss) maxrss = ru.ru_maxrss;
+    }
+
+    for(int i=first;i<argc;i++) printf("%s ", argv[i]);
+    printf("\n  best %.2f ms  mean %.2f ms  max RSS %ld KB\n",
+           best * 1e3, sum / reps * 1e3, maxrss);
+    return 0;
+}
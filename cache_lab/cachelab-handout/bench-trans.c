@@ -0,0 +1,219 @@
+/*
+ * bench-trans.c - Time the registered transpose functions on real hardware
+ *
+ * Links an -O2 build of trans.c and runs every function registered in
+ * func_list on square matrices from -m to -x wide (default 256 to 8192,
+ * doubling). Each size gets one warmup run, checked with is_transpose(),
+ * then -r timed runs (default 5). It reports the mean time per element,
+ * the relative standard deviation across runs and the bandwidth, counting
+ * one read and one write of every element, e.g.
+ *
+ *     ./bench-trans -c 2 -r 10 -x 4096
+ *
+ * -c pins the process to one CPU so the runs do not migrate.
+ *
+ * -p N instead measures how transpose_parallel() scales from 1 to N
+ * threads, e.g. ./bench-trans -p 8 -m 4096 -x 8192. Each thread count gets
+ * freshly mapped matrices, first touched by the same split into bands
+ * that it then transposes with.
+ *
+ * -k times nothing: it runs every function once on each of checkShapes,
+ * in matrices allocated to the exact size, and checks the result. make
+ * check runs it from a build with AddressSanitizer, which also catches
+ * writes past A or B.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "cachelab.h"
+#include "trans.h"
+
+extern trans_func_t func_list[MAX_TRANS_FUNCS];
+extern int func_counter;
+extern void registerFunctions();
+extern int is_transpose(int M, int N, int A[N][M], int B[M][N]);
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * Shapes M x N for -k: the graded N with other M, then sides that are not
+ * multiples of the SIMD kernels' 4 and 8 wide tiles, or smaller than one
+ */
+static const int checkShapes[][2] = {
+    {20, 32}, {36, 32}, {12, 64}, {100, 64}, {32, 64}, {40, 67}, {67, 67},
+    {1, 1}, {3, 5}, {7, 3}, {4, 9}, {9, 4}, {13, 11}, {8, 17}, {23, 16}, {61, 67},
+    {67, 61}, {100, 50}, {255, 129},
+};
+
+// runs every function once on each of checkShapes, returns the number that went wrong
+static int check(void)
+{
+    int wrong = 0;
+    for(size_t k=0;k<sizeof(checkShapes)/sizeof(checkShapes[0]);k++){
+        int M = checkShapes[k][0], N = checkShapes[k][1];
+        int* A = malloc((size_t)M * N * sizeof(int));
+        int* B = malloc((size_t)M * N * sizeof(int));
+        initMatrix(M, N, (int (*)[M]) A, (int (*)[N]) B);
+        for(int i=0;i<func_counter;i++){
+            memset(B, 0, (size_t)M * N * sizeof(int));
+            (*func_list[i].func_ptr)(M, N, (int (*)[M]) A, (int (*)[N]) B);
+            if(!is_transpose(M, N, (int (*)[M]) A, (int (*)[N]) B)){
+                printf("func %d (%s) is wrong at %dx%d\n", i, func_list[i].description, M, N);
+                wrong++;
+            }
+        }
+        free(A);
+        free(B);
+    }
+    return wrong;
+}
+
+// times fn on A and B reps times, returns the mean ns/element and sets *rsd in percent
+static double time_runs(void (*fn)(int, int, int[][*], int[][*]), int n, int* A, int* B,
+                        int reps, double* rsd)
+{
+    double sum = 0, sumsq = 0;
+    for(int r=0;r<reps;r++){
+        double start = now();
+        (*fn)(n, n, (int (*)[n]) A, (int (*)[n]) B);
+        double ns = (now() - start) * 1e9 / ((double)n * n);
+        sum += ns;
+        sumsq += ns * ns;
+    }
+    double mean = sum / reps;
+    double var = sumsq / reps - mean * mean;
+    *rsd = var > 0 ? sqrt(var) / mean * 100 : 0;
+    return mean;
+}
+
+// pages no thread has touched yet, which malloc() could not promise on reuse
+static int* fresh_pages(size_t bytes)
+{
+    void* p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+// scaling of transpose_parallel() from 1 to maxThreads threads
+static int scaling(int maxThreads, int min, int max, int reps)
+{
+    printf("%7s %6s %10s %7s %8s %8s\n", "threads", "size", "ns/elem", "rsd%", "GB/s", "speedup");
+    for(int n=min;n<=max;n*=2){
+        size_t bytes = (size_t)n * n * sizeof(int);
+        double base = 0;
+        for(int t=1;t<=maxThreads;t++){
+            int* A = fresh_pages(bytes);
+            int* B = fresh_pages(bytes);
+            double rsd;
+            if(!A || !B){
+                printf("%d x %d does not fit in memory, stopping\n", n, n);
+                if(A) munmap(A, bytes);
+                if(B) munmap(B, bytes);
+                return 0;
+            }
+            // first touch with t threads, so each one's pages sit where its band runs
+            transpose_set_threads(t);
+            transpose_first_touch(n, n, (int (*)[n]) A, (int (*)[n]) B);
+            initMatrix(n, n, (int (*)[n]) A, (int (*)[n]) B);
+            transpose_parallel(n, n, (int (*)[n]) A, (int (*)[n]) B);
+            if(!is_transpose(n, n, (int (*)[n]) A, (int (*)[n]) B)){
+                printf("%7d %6d %10s\n", t, n, "wrong");
+                return 1;
+            }
+            double mean = time_runs(transpose_parallel, n, A, B, reps, &rsd);
+            munmap(A, bytes);
+            munmap(B, bytes);
+            if(t == 1) base = mean;
+            printf("%7d %6d %10.3f %7.2f %8.2f %8.2f\n", t, n, mean, rsd,
+                   2 * sizeof(int) / mean, base / mean);
+            fflush(stdout);
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    int reps = 5, min = 256, max = 8192, cpu = -1, only = -1, threads = 0, checkOnly = 0, c;
+
+    while((c = getopt(argc, argv, "r:m:x:c:f:p:kh")) != -1){
+        switch(c){
+        case 'r': reps = atoi(optarg); break;
+        case 'm': min = atoi(optarg); break;
+        case 'x': max = atoi(optarg); break;
+        case 'c': cpu = atoi(optarg); break;
+        case 'f': only = atoi(optarg); break;
+        case 'p': threads = atoi(optarg); break;
+        case 'k': checkOnly = 1; break;
+        default:
+            printf("Usage: %s [-k] [-r reps] [-m min] [-x max] [-c cpu] [-f func] [-p threads]\n", argv[0]);
+            return c == 'h' ? 0 : 1;
+        }
+    }
+    if(reps < 1 || min < 1 || max < min || threads < 0 || threads > TRANS_MAX_THREADS){
+        printf("Bad -r, -m, -x or -p\n");
+        return 1;
+    }
+    if(cpu >= 0){
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if(sched_setaffinity(0, sizeof(set), &set) < 0){
+            perror("sched_setaffinity");
+            return 1;
+        }
+    }
+
+    if(threads) return scaling(threads, min, max, reps);
+
+    registerFunctions();
+    if(checkOnly){
+        int wrong = check();
+        printf("%d wrong\n", wrong);
+        return wrong > 0;
+    }
+    printf("%-4s %6s %10s %7s %8s  %s\n", "func", "size", "ns/elem", "rsd%", "GB/s", "description");
+    for(int n=min;n<=max;n*=2){
+        size_t elems = (size_t)n * n;
+        int* A = malloc(elems * sizeof(int));
+        int* B = malloc(elems * sizeof(int));
+        if(!A || !B){
+            printf("%d x %d does not fit in memory, stopping\n", n, n);
+            free(A);
+            free(B);
+            break;
+        }
+        // touch every page up front so no run pays for faulting them in
+        initMatrix(n, n, (int (*)[n]) A, (int (*)[n]) B);
+        memset(B, 0, elems * sizeof(int));
+
+        for(int i=0;i<func_counter;i++){
+            if(only >= 0 && i != only) continue;
+            double rsd;
+
+            (*func_list[i].func_ptr)(n, n, (int (*)[n]) A, (int (*)[n]) B);
+            if(!is_transpose(n, n, (int (*)[n]) A, (int (*)[n]) B)){
+                printf("%-4d %6d %10s %7s %8s  %s\n", i, n, "wrong", "-", "-",
+                       func_list[i].description);
+                continue;
+            }
+            double mean = time_runs(func_list[i].func_ptr, n, A, B, reps, &rsd);
+            printf("%-4d %6d %10.3f %7.2f %8.2f  %s\n", i, n, mean, rsd,
+                   2 * sizeof(int) / mean, func_list[i].description);
+            fflush(stdout);
+        }
+        free(A);
+        free(B);
+    }
+    return 0;
+}
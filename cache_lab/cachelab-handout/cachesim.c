@@ -0,0 +1,206 @@
+/*
+ * cachesim.c - Allocation, the out-of-line helpers and the trace replay
+ *     loop of the cache model
+ */
+#include "cachesim.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+const char* policyNames[NPOLICIES] = {"lru", "fifo", "lfu", "random", "plru", "srrip", "brrip"};
+
+Cache* newCache(int s, int E, int b, Policy policy, bool data){
+    size_t S = (size_t)1 << s;
+    size_t lines = (size_t)S * E;
+    int words = (E + 63) / 64;
+    size_t bytes = sizeof(Cache)
+                 + (size_t)S * (2 * words + 1) * sizeof(unsigned long long)
+                 + lines * sizeof(unsigned long long)
+                 + lines * sizeof(unsigned);
+    Cache* c = (Cache*) calloc(1, bytes);
+    c->s = s; c->E = E; c->b = b;
+    c->tagShift = s + b;
+    c->setMask = S - 1;
+    c->policy = policy;
+    c->match = tagmatch_select(E);
+    c->words = words;
+    c->valid = (unsigned long long*)(c + 1);
+    c->dirty = c->valid + (size_t)S * words;
+    c->setmeta = c->dirty + (size_t)S * words;
+    c->tags = c->setmeta + S;
+    c->stamps = (unsigned*)(c->tags + lines);
+    if(data) c->data = calloc(lines, (size_t)1 << b);
+    return c;
+}
+
+void freeCache(Cache* c){
+    free(c->prefetch);
+    free(c->data);
+    free(c);
+}
+
+// returns the first invalid way in set, or -1 if the set is full
+int find_empty(Cache* c, int set){
+    unsigned long long* valid = c->valid + (size_t)set * c->words;
+    for(int w=0;w<c->words;w++){
+        if(~valid[w]){
+            int way = w * 64 + __builtin_ctzll(~valid[w]);
+            return way < c->E ? way : -1;
+        }
+    }
+    return -1;
+}
+
+// returns the way with the smallest stamp in set
+int find_min_stamp(Cache* c, int set){
+    unsigned* stamps = c->stamps + (size_t)set * c->E;
+    int victim = 0;
+    for(int j=1;j<c->E;j++){
+        if(stamps[j] < stamps[victim]) victim = j;
+    }
+    return victim;
+}
+
+// returns the first way predicted to be re-referenced furthest away, ageing the set until that is RRPV_MAX
+int find_rrip(Cache* c, int set){
+    unsigned* rrpv = c->stamps + (size_t)set * c->E;
+    int victim = 0;
+    for(int j=1;j<c->E;j++){
+        if(rrpv[j] > rrpv[victim]) victim = j;
+    }
+    unsigned age = RRPV_MAX - rrpv[victim];
+    if(age){
+        for(int j=0;j<c->E;j++) rrpv[j] += age;
+    }
+    return victim;
+}
+
+// follows the PLRU tree bits in set towards the pseudo least recently used way
+int find_plru(Cache* c, int set){
+    unsigned long long bits = c->setmeta[set];
+    int node = 1;
+    while(node < c->E) node = 2 * node + ((bits >> node) & 1);
+    return node - c->E;
+}
+
+// points every PLRU tree node on the path to way away from it
+void touch_plru(Cache* c, int set, int way){
+    unsigned long long bits = c->setmeta[set];
+    int node = 1;
+    for(int level=c->E>>1;level;level>>=1){
+        int right = (way & level) != 0;
+        if(right) bits &= ~(1ULL << node);
+        else bits |= 1ULL << node;
+        node = 2 * node + right;
+    }
+    c->setmeta[set] = bits;
+}
+
+typedef struct Stamp{
+    unsigned stamp;
+    int way;
+} Stamp;
+
+int byStamp(const void* x, const void* y){
+    unsigned p = ((const Stamp*)x)->stamp, q = ((const Stamp*)y)->stamp;
+    return p < q ? -1 : p > q;
+}
+
+// replaces set's stamps by their ranks, equal stamps sharing one, so its clock can restart at E
+void renumber(Cache* c, int set){
+    unsigned* stamps = c->stamps + (size_t)set * c->E;
+    Stamp* order = malloc(sizeof(Stamp) * c->E);
+    for(int j=0;j<c->E;j++) order[j] = (Stamp){stamps[j], j};
+    qsort(order, c->E, sizeof(Stamp), byStamp);
+    for(int r=0;r<c->E;r++){
+        bool tie = r > 0 && order[r].stamp == order[r - 1].stamp;
+        stamps[order[r].way] = tie ? stamps[order[r - 1].way] : r + 1;
+    }
+    free(order);
+    c->setmeta[set] = c->E;
+}
+
+/*
+ * The traces carry addresses but no values, so a fill just writes a
+ * pattern derived from the block into the line, costing what copying the
+ * block in would.
+ */
+void fill_data(Cache* c, int set, int way, unsigned long long tag){
+    size_t B = (size_t)1 << c->b;
+    memset(c->data + ((size_t)set * c->E + way) * B, tag ^ set, B);
+}
+
+ALWAYS_INLINE
+void replay(Cache* c, Shard* sh, Tlb* tlb, trace_reader_t* reader, cachesim_observer observe,
+            void* arg, const Policy p){
+    trace_access_t access;
+    while(trace_next(reader, &access)){
+        if(tlb){
+            tlb_access(tlb, access.addr, access.size);
+            if(access.op == 'M') tlb_access(tlb, access.addr, access.size);
+        }
+        unsigned long long tag;
+        int set_index = split(c, access.addr, &tag);
+        int first, second = -1;
+        switch(access.op){
+        case 'M':
+            first = load(c, sh, set_index, tag, p);
+            second = store(c, sh, set_index, tag, access.size, p);
+            break;
+        case 'S':
+            first = store(c, sh, set_index, tag, access.size, p); break;
+        case 'L':
+        default:
+            first = load(c, sh, set_index, tag, p); break;
+        }
+        if(observe) observe(&access, first, second, arg);
+    }
+}
+
+int cachesim_run(const CacheConfig* cfg, trace_reader_t* reader, CacheStats* stats,
+                 cachesim_observer observe, void* arg){
+    if(cfg->s < 0 || cfg->s > 30 || cfg->E < 1 || cfg->b < 0 || cfg->s + cfg->b > 63 ||
+       cfg->policy < 0 || cfg->policy >= NPOLICIES ||
+       (cfg->policy == PLRU && (cfg->E > 64 || (cfg->E & (cfg->E - 1)))) ||
+       cfg->prefetch.kind < 0 || cfg->prefetch.kind >= NPREFETCHERS ||
+       (cfg->tlb.pageBits && tlb_check(&cfg->tlb) < 0))
+        return -1;
+
+    Cache* c = newCache(cfg->s, cfg->E, cfg->b, cfg->policy, cfg->data);
+    Shard sh = {0};
+    c->writeThrough = cfg->writeThrough;
+    c->noWriteAllocate = cfg->noWriteAllocate;
+    Tlb* tlb = cfg->tlb.pageBits ? newTlb(&cfg->tlb) : NULL;
+    if(cfg->prefetch.kind != PF_NONE) prefetch_attach(c, &cfg->prefetch);
+    switch(cfg->policy){
+    case LRU:    replay(c, &sh, tlb, reader, observe, arg, LRU); break;
+    case FIFO:   replay(c, &sh, tlb, reader, observe, arg, FIFO); break;
+    case LFU:    replay(c, &sh, tlb, reader, observe, arg, LFU); break;
+    case RANDOM: replay(c, &sh, tlb, reader, observe, arg, RANDOM); break;
+    case PLRU:   replay(c, &sh, tlb, reader, observe, arg, PLRU); break;
+    case SRRIP:  replay(c, &sh, tlb, reader, observe, arg, SRRIP); break;
+    case BRRIP:  replay(c, &sh, tlb, reader, observe, arg, BRRIP); break;
+    default:     break;
+    }
+    freeCache(c);
+    memset(stats, 0, sizeof(*stats));
+    cachesim_add(stats, &sh);
+    if(tlb) stats->tlb = tlb->stats;
+    freeTlb(tlb);
+    return 0;
+}
+
+void cachesim_add(CacheStats* stats, const Shard* sh){
+    stats->hits += sh->hits;
+    stats->misses += sh->misses;
+    stats->evictions += sh->evictions;
+    stats->writebacks += sh->writebacks;
+    stats->memwrites += sh->memwrites;
+    stats->memwriteBytes += sh->memwriteBytes;
+    stats->pfIssued += sh->pfIssued;
+    stats->pfUseful += sh->pfUseful;
+    stats->pfLate += sh->pfLate;
+    stats->pfPolluting += sh->pfPolluting;
+    stats->pfEvictions += sh->pfEvictions;
+    stats->pfWritebacks += sh->pfWritebacks;
+}
@@ -0,0 +1,309 @@
+/*
+ * cachesim.h - Set-associative cache model shared by csim and test-trans
+ *
+ * The per-access paths are inline so that callers replaying a trace get a
+ * loop specialized for one replacement policy.
+ */
+
+#ifndef CACHELAB_CACHESIM_H
+#define CACHELAB_CACHESIM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <limits.h>
+#include "tagmatch.h"
+#include "trace.h"
+#include "prefetch.h"
+#include "tlb.h"
+
+typedef enum Policy{
+    LRU,
+    FIFO,
+    LFU,
+    RANDOM,
+    PLRU,
+    SRRIP,
+    BRRIP,
+    NPOLICIES,
+} Policy;
+
+extern const char* policyNames[NPOLICIES];
+
+#define RRPV_MAX    3       /* 2-bit re-reference prediction values */
+#define BRRIP_EPS   32      /* BRRIP inserts at RRPV_MAX-1 once in this many fills */
+
+/*
+ * The model keeps metadata only: all per-line state lives in one
+ * allocation, laid out set-major as a structure of arrays. Tag i*E+j and
+ * stamp i*E+j belong to way j of set i, and each set owns `words` 64-bit
+ * words of the valid and dirty bitmaps and one word of set-wide
+ * replacement state. Block contents are only kept with -d.
+ *
+ * What a stamp means depends on the replacement policy: the last use for
+ * LRU, the fill time for FIFO, the use count for LFU and the re-reference
+ * prediction value for SRRIP/BRRIP. LRU and FIFO run a clock per set in
+ * the set word; tree-PLRU keeps its E-1 tree bits there instead, and
+ * random and BRRIP their random state, so a set draws the same numbers
+ * whichever thread simulates it.
+ */
+typedef struct Cache{
+    int s, E, b;
+    int tagShift;                   /* s + b */
+    unsigned long long setMask;     /* S - 1 */
+    Policy policy;
+    bool writeThrough;      /* stores also go to memory and never dirty a line */
+    bool noWriteAllocate;   /* store misses go to memory without filling */
+    tagmatch_fn match;
+    int words;
+    unsigned long long* tags;
+    unsigned* stamps;
+    unsigned long long* valid;
+    unsigned long long* dirty;
+    unsigned long long* setmeta;
+    char* data;             /* S*E blocks of backing data, only with -d */
+    struct Prefetcher* prefetch;    /* hardware prefetcher, NULL for demand fetch only */
+} Cache;
+
+/*
+ * Counters and random state for the sets one thread simulates.
+ */
+typedef struct Shard{
+    unsigned long long hits, misses, evictions;
+    unsigned long long writebacks;      /* dirty lines evicted */
+    unsigned long long invalidations;   /* lines removed to keep an upper level inclusive */
+    unsigned long long memwrites;       /* stores sent straight to memory */
+    unsigned long long memwriteBytes;
+    unsigned long long pfIssued, pfUseful, pfLate, pfPolluting;    /* see prefetch.h */
+    unsigned long long pfEvictions, pfWritebacks;   /* caused by prefetch fills, not in the above */
+} Shard;
+
+/*
+ * What cachesim_run() simulates: a single cache level.
+ */
+typedef struct CacheConfig{
+    int s, E, b;
+    Policy policy;
+    bool writeThrough;
+    bool noWriteAllocate;
+    bool data;              /* keep block contents */
+    PrefetchConfig prefetch;
+    TlbConfig tlb;          /* translated in the same pass when pageBits is set */
+} CacheConfig;
+
+/*
+ * Counts from one cachesim_run().
+ */
+typedef struct CacheStats{
+    unsigned long long hits, misses, evictions;
+    unsigned long long writebacks;
+    unsigned long long memwrites;
+    unsigned long long memwriteBytes;
+    unsigned long long pfIssued, pfUseful, pfLate, pfPolluting;
+    unsigned long long pfEvictions, pfWritebacks;
+    TlbStats tlb;
+} CacheStats;
+
+/*
+ * Called after every access is simulated with the outcome of its first
+ * and, for an M access, second reference (-1 otherwise).
+ */
+typedef void (*cachesim_observer)(const trace_access_t* access, int first, int second,
+                                  void* arg);
+
+/*
+ * cachesim_run - Simulate every access reader yields in a fresh cache
+ *     built from cfg and store the counts in stats. observe may be NULL.
+ *     Returns -1 if cfg is not a valid cache and TLB, 0 otherwise.
+ */
+int cachesim_run(const CacheConfig* cfg, trace_reader_t* reader, CacheStats* stats,
+                 cachesim_observer observe, void* arg);
+
+/* Add the counts in sh to stats */
+void cachesim_add(CacheStats* stats, const Shard* sh);
+
+/* Allocate a cache with 2^s sets of E lines of 2^b bytes; data keeps block contents */
+Cache* newCache(int s, int E, int b, Policy policy, bool data);
+void freeCache(Cache* c);
+
+int find_empty(Cache* c, int set);
+int find_min_stamp(Cache* c, int set);
+int find_rrip(Cache* c, int set);
+int find_plru(Cache* c, int set);
+void touch_plru(Cache* c, int set, int way);
+void renumber(Cache* c, int set);
+void fill_data(Cache* c, int set, int way, unsigned long long tag);
+
+// splits addr into set index and tag
+static inline int split(Cache* c, unsigned long long addr, unsigned long long* tag){
+    *tag = addr >> c->tagShift;
+    return (addr >> c->b) & c->setMask;
+}
+
+static inline bool test_bit(Cache* c, unsigned long long* map, int set, int way){
+    return (map[(size_t)set * c->words + (way >> 6)] >> (way & 63)) & 1;
+}
+
+static inline void set_bit(Cache* c, unsigned long long* map, int set, int way){
+    map[(size_t)set * c->words + (way >> 6)] |= 1ULL << (way & 63);
+}
+
+static inline void clear_bit(Cache* c, unsigned long long* map, int set, int way){
+    map[(size_t)set * c->words + (way >> 6)] &= ~(1ULL << (way & 63));
+}
+
+// returns the way holding tag in set, or -1
+static inline int find_tag(Cache* c, int set, unsigned long long tag){
+    return c->match(c->tags + (size_t)set * c->E,
+                    c->valid + (size_t)set * c->words, c->E, tag);
+}
+
+// advances set's clock, renumbering before the 32-bit stamps can overflow
+static inline unsigned next_stamp(Cache* c, int set){
+    if(c->setmeta[set] == UINT_MAX) renumber(c, set);
+    return ++c->setmeta[set];
+}
+
+// xorshift64 on set's own state, seeded from the set index on first use
+static inline unsigned long long next_random(Cache* c, int set){
+    unsigned long long x = c->setmeta[set];
+    if(!x) x = (set + 1ULL) * 0x9e3779b97f4a7c15ULL;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return c->setmeta[set] = x;
+}
+
+enum { HIT, MISS, MISS_EVICTION };
+
+/*
+ * Functions taking a `const Policy p` are always inlined and called with
+ * a constant, so every policy gets its own specialized replay loop and
+ * there is no dispatch per access. The switch on policy happens once per
+ * run, e.g. in cachesim_run() and csim's worker().
+ */
+#define ALWAYS_INLINE static inline __attribute__((always_inline))
+
+// picks the way to evict from a full set
+ALWAYS_INLINE
+int choose_victim(Cache* c, Shard* sh, int set, const Policy p){
+    switch(p){
+    case RANDOM: return next_random(c, set) % c->E;
+    case PLRU:   return find_plru(c, set);
+    case SRRIP:
+    case BRRIP:  return find_rrip(c, set);
+    default:     return find_min_stamp(c, set);
+    }
+}
+
+// updates replacement state for a line just filled
+ALWAYS_INLINE
+void on_fill(Cache* c, Shard* sh, int set, int way, const Policy p){
+    unsigned* stamp = &c->stamps[(size_t)set * c->E + way];
+    switch(p){
+    case LRU:
+    case FIFO:  *stamp = next_stamp(c, set); break;
+    case LFU:   *stamp = 1; break;
+    case SRRIP: *stamp = RRPV_MAX - 1; break;
+    case BRRIP: *stamp = next_random(c, set) % BRRIP_EPS ? RRPV_MAX : RRPV_MAX - 1; break;
+    case PLRU:  touch_plru(c, set, way); break;
+    default:    break;
+    }
+}
+
+// updates replacement state for a line that was hit
+ALWAYS_INLINE
+void on_hit(Cache* c, Shard* sh, int set, int way, const Policy p){
+    unsigned* stamp = &c->stamps[(size_t)set * c->E + way];
+    switch(p){
+    case LRU:   *stamp = next_stamp(c, set); break;
+    case LFU:   if(*stamp != UINT_MAX) ++*stamp; break;
+    case SRRIP:
+    case BRRIP: *stamp = 0; break;
+    case PLRU:  touch_plru(c, set, way); break;
+    default:    break;
+    }
+}
+
+/*
+ * insert_block - Place tag in set, evicting under policy p if the set is
+ *     full. Returns the way used; *victim is set to the evicted tag and
+ *     *victim_dirty to its dirty bit, or *victim_dirty to -1 if nothing
+ *     was evicted.
+ */
+ALWAYS_INLINE
+int insert_block(Cache* c, Shard* sh, int set, unsigned long long tag, unsigned long long* victim,
+                 int* victim_dirty, const Policy p){
+    int way = find_empty(c, set);
+    *victim_dirty = -1;
+    if(way < 0){
+        sh->evictions++;
+        way = choose_victim(c, sh, set, p);
+        *victim = c->tags[(size_t)set * c->E + way];
+        *victim_dirty = test_bit(c, c->dirty, set, way);
+        if(*victim_dirty) sh->writebacks++;
+    } else{
+        set_bit(c, c->valid, set, way);
+    }
+    clear_bit(c, c->dirty, set, way);
+    c->tags[(size_t)set * c->E + way] = tag;
+    if(c->data) fill_data(c, set, way, tag);
+    on_fill(c, sh, set, way, p);
+    return way;
+}
+
+/*
+ * access_block - Look up tag in set, updating it under policy p. *way is
+ *     set to the way now holding tag.
+ */
+ALWAYS_INLINE
+int access_block(Cache* c, Shard* sh, int set, unsigned long long tag, int* way, const Policy p){
+    if(c->prefetch) prefetch_issue(c, sh);
+    *way = find_tag(c, set, tag);
+    if(*way >= 0){
+        // hit
+        sh->hits++;
+        on_hit(c, sh, set, *way, p);
+        if(c->prefetch) prefetch_train(c, sh, set, *way, true);
+        return HIT;
+    }
+    // miss
+    unsigned long long victim;
+    int victim_dirty;
+    sh->misses++;
+    *way = insert_block(c, sh, set, tag, &victim, &victim_dirty, p);
+    if(c->prefetch) prefetch_train(c, sh, set, *way, false);
+    return victim_dirty < 0 ? MISS : MISS_EVICTION;
+}
+
+ALWAYS_INLINE
+int load(Cache* c, Shard* sh, int set, unsigned long long tag, const Policy p){
+    int way;
+    return access_block(c, sh, set, tag, &way, p);
+}
+
+/*
+ * store - A write-back hit dirties the line; a write-through hit, and a
+ *     miss under no-write-allocate, send the store to memory instead.
+ */
+ALWAYS_INLINE
+int store(Cache* c, Shard* sh, int set, unsigned long long tag, unsigned size, const Policy p){
+    int way, result;
+    // the queued prefetches may fill tag's block before the lookup
+    if(c->noWriteAllocate && c->prefetch) prefetch_issue(c, sh);
+    if(c->noWriteAllocate && find_tag(c, set, tag) < 0){
+        if(c->prefetch) prefetch_train_bypass(c, sh, set, tag);
+        sh->misses++;
+        result = MISS;
+    } else{
+        result = access_block(c, sh, set, tag, &way, p);
+        if(!c->writeThrough){
+            set_bit(c, c->dirty, set, way);
+            return result;
+        }
+    }
+    sh->memwrites++;
+    sh->memwriteBytes += size;
+    return result;
+}
+
+#endif /* CACHELAB_CACHESIM_H */
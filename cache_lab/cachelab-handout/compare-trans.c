@@ -0,0 +1,151 @@
+/*
+ * compare-trans.c - Compares the misses of every registered transpose
+ *     function across a grid of cache geometries.
+ *
+ * Each function runs in-process on the instrumented trans.c, the same way
+ * test-trans -n measures it, once per geometry in the grid:
+ *
+ *     ./compare-trans -M 64 -N 64 -s 3-8 -E 1-8 -b 4-6
+ *
+ * s and b step by one and E doubles. The table gives each function's
+ * misses per geometry, with the best marked by '*'. The summary counts the
+ * geometries each function wins, ties included, and gives the geometric
+ * mean of its misses over the best for each geometry.
+ *
+ * -f adds a prefetcher to every cache, in csim's -f syntax, e.g. -f stream.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include "cachelab.h"
+#include "cachesim.h"
+#include "tracer.h"
+
+extern trans_func_t func_list[MAX_TRANS_FUNCS];
+extern int func_counter;
+extern void registerFunctions();
+
+static int M, N;
+static PrefetchConfig prefetch;
+static int* mat;
+
+/*
+ * simulate_func - Run function i under the cache (s, E, b). Returns the
+ *     number of misses, or -1 if the result is not the transpose.
+ */
+static long long simulate_func(int i, int s, int E, int b)
+{
+    CacheConfig cfg = {s, E, b, LRU, false, false, false, prefetch};
+    CacheStats st;
+
+    if (!tracer_simulate(&cfg, mat, M, N, func_list[i].func_ptr, &st))
+        return -1;
+    return st.misses;
+}
+
+static int parse_range(char* arg, int* lo, int* hi)
+{
+    char* end;
+    *lo = *hi = strtol(arg, &end, 10);
+    if (*end == '-')
+        *hi = strtol(end + 1, &end, 10);
+    return (end == arg || *end || *lo > *hi) ? -1 : 0;
+}
+
+static void usage(char* argv[])
+{
+    printf("Usage: %s [-h] [-s <lo-hi>] [-E <lo-hi>] [-b <lo-hi>] [-f <prefetcher>] -M <rows> -N <cols>\n", argv[0]);
+    printf("Options:\n");
+    printf("  -h          Print this help message.\n");
+    printf("  -s <lo-hi>  Set index bits to try (default 3-8)\n");
+    printf("  -E <lo-hi>  Associativities to try, doubling (default 1-8)\n");
+    printf("  -b <lo-hi>  Block bits to try (default 4-6)\n");
+    printf("  -f <spec>   Prefetcher kind[:degree[:latency]], kind next, stride or stream\n");
+    printf("  -M <rows>   Number of matrix rows (max %d)\n", TRACER_MAXN);
+    printf("  -N <cols>   Number of matrix columns (max %d)\n", TRACER_MAXN);
+    printf("Example: %s -M 64 -N 64 -s 5 -E 1-4\n", argv[0]);
+}
+
+int main(int argc, char* argv[])
+{
+    int slo = 3, shi = 8, Elo = 1, Ehi = 8, blo = 4, bhi = 6, c;
+    int wins[MAX_TRANS_FUNCS] = {0}, ngeom = 0;
+    double logratio[MAX_TRANS_FUNCS] = {0};
+    long long misses[MAX_TRANS_FUNCS];
+
+    while ((c = getopt(argc, argv, "hs:E:b:f:M:N:")) != -1) {
+        int bad = 0;
+        switch (c) {
+        case 's': bad = parse_range(optarg, &slo, &shi); break;
+        case 'E': bad = parse_range(optarg, &Elo, &Ehi); break;
+        case 'b': bad = parse_range(optarg, &blo, &bhi); break;
+        case 'f': bad = prefetch_parse(optarg, &prefetch); break;
+        case 'M': M = atoi(optarg); break;
+        case 'N': N = atoi(optarg); break;
+        case 'h':
+            usage(argv);
+            exit(0);
+        default:
+            bad = 1;
+        }
+        if (bad) {
+            usage(argv);
+            exit(1);
+        }
+    }
+    if (M < 1 || N < 1 || M > TRACER_MAXN || N > TRACER_MAXN || slo < 0 || shi > 30 ||
+        Elo < 1 || blo < 0 || shi + bhi > 63) {
+        printf("Error: Missing or bad argument\n");
+        usage(argv);
+        exit(1);
+    }
+
+    if (!(mat = tracer_matrices())) {
+        printf("Error: out of memory\n");
+        exit(1);
+    }
+    registerFunctions();
+
+    for (int i=0; i<func_counter; i++)
+        printf("f%-3d %s\n", i, func_list[i].description);
+    printf("\n%3s %3s %3s %6s", "s", "E", "b", "bytes");
+    for (int i=0; i<func_counter; i++) {
+        char name[16];
+        sprintf(name, "f%d", i);
+        printf(" %10s ", name);
+    }
+    printf("\n");
+
+    for (int s=slo; s<=shi; s++)
+    for (int E=Elo; E<=Ehi; E*=2)
+    for (int b=blo; b<=bhi; b++) {
+        long long best = -1;
+        for (int i=0; i<func_counter; i++) {
+            misses[i] = simulate_func(i, s, E, b);
+            if (misses[i] >= 0 && (best < 0 || misses[i] < best))
+                best = misses[i];
+        }
+        printf("%3d %3d %3d %6lld", s, E, b, (long long) E << (s + b));
+        for (int i=0; i<func_counter; i++) {
+            if (misses[i] < 0) {
+                printf(" %10s ", "wrong");
+                continue;
+            }
+            printf(" %10lld%c", misses[i], misses[i] == best ? '*' : ' ');
+            wins[i] += misses[i] == best;
+            logratio[i] += log((double) (misses[i] + 1) / (best + 1));
+        }
+        printf("\n");
+        ngeom++;
+    }
+
+    printf("\n%-4s %6s %10s  %s\n", "func", "wins", "vs best", "description");
+    for (int i=0; i<func_counter; i++)
+        printf("f%-3d %6d %9.2fx  %s\n", i, wins[i], exp(logratio[i] / ngeom),
+               func_list[i].description);
+    free(mat);
+    return 0;
+}
@@ -1,4 +1,7 @@
+#define _POSIX_C_SOURCE 200809L
 #include "cachelab.h"
+#include "cachesim.h"
+#include "trace.h"
 
 #include <stdio.h>
 #include <unistd.h>
@@ -6,24 +9,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
-#include <ctype.h>
-
-typedef struct Line{
-    bool valid;
-    int tag;
-    char* data;
-    struct Line* next;
-    struct Line* prev;
-} Line;
-
-typedef struct Set{
-    Line* head;
-    Line* tail;
-} Set;
-
-typedef struct Cache{
-    Set* sets;
-} Cache;
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sched.h>
+#include <limits.h>
 
 typedef enum Mode{
     L,
@@ -34,24 +23,97 @@ typedef enum Mode{
 bool v;
 int s, E, b;
 char* t;
+char* w;
+int j = 1;
+Policy policy = LRU;
+bool writeThrough = false;
+bool noWriteAllocate = false;
+bool writeStats = false;        /* -W or -A given: report write traffic too */
+bool backingData = false;
+bool markers = false;
+bool markersMissing = false;    /* -m found nothing to simulate */
+char* profilePrefix;
+int sampleSets;
+char* windowSpec;
+PrefetchConfig prefetch;
+TlbConfig tlbConfig;
+
+#define MAX_LEVELS 8
+
+typedef enum Inclusion{
+    INCLUSIVE,
+    EXCLUSIVE,
+    NINE,
+    NINCLUSIONS,
+} Inclusion;
+
+const char* inclusionNames[NINCLUSIONS] = {"inclusive", "exclusive", "nine"};
+
+char* levelSpecs[MAX_LEVELS];
+int nlevels;
+Inclusion inclusion = NINE;
 
 void printUsage(){
     printf("\
-Usage: ./csim-ref [-hv] -s <num> -E <num> -b <num> -t <file>\n\
+Usage: ./csim-ref [-hv] -s <num> -E <num> -b <num> -t <file> [-p <policy>]\n\
+       ./csim-ref [-h] -s <num> -E <num> -b <num> -t <file> [-p <policy>] -j <num>\n\
+       ./csim-ref [-h] -w <configs> -t <file>\n\
+       ./csim-ref [-h] -l <level> [-l <level> ...] [-i <inclusion>] -t <file>\n\
+       ./csim-ref [-h] -s <num> -E <num> -b <num> -t <file> -P <prefix>\n\
+       ./csim-ref [-h] -s <num> -E <num> -b <num> -t <file> [-k <num>] [-T <window>]\n\
+       ./csim-ref [-hv] -s <num> -E <num> -b <num> -t <file> -f <prefetcher>\n\
         Options:\n\
         -h         Print this help message.\n\
         -v         Optional verbose flag.\n\
         -s <num>   Number of set index bits.\n\
         -E <num>   Number of lines per set.\n\
         -b <num>   Number of block offset bits.\n\
-        -t <file>  Trace file.\n\
+        -t <file>  Trace file (lackey text or trace2bin binary), or - to\n\
+                   read the trace from stdin as it is produced.\n\
+        -m         Only simulate the region tracegen marks in the trace,\n\
+                   skipping stack accesses, like test-trans does.\n\
+        -p <name>  Replacement policy: lru (default), fifo, lfu, random,\n\
+                   plru (tree pseudo-LRU, E a power of two up to 64),\n\
+                   srrip or brrip.\n\
+        -d         Also simulate each line's backing data (S*E*B bytes).\n\
+        -W <name>  Write hit policy: wb (write-back, default) or wt\n\
+                   (write-through).\n\
+        -A <name>  Write miss policy: wa (write-allocate, default) or\n\
+                   nwa (no-write-allocate). With -W, -A or -v, dirty\n\
+                   evictions and memory writes are reported too.\n\
+        -j <num>   Simulate on <num> worker threads, each owning a\n\
+                   share of the sets (not combined with -v, -w or -l).\n\
+        -w <list>  Sweep mode: simulate every LRU configuration in a\n\
+                   comma separated list of s:E:b in one pass. Each\n\
+                   field may be a range lo-hi, e.g. -w 5:1-16:5,4:4:4-6\n\
+        -l <level> Hierarchy mode: add a cache level s:E:b[:policy] below\n\
+                   the previous one, L1 first. All levels share b and\n\
+                   are write-back, write-allocate.\n\
+        -i <name>  Inclusion between levels: inclusive, exclusive or\n\
+                   nine (non-inclusive non-exclusive, the default).\n\
+        -P <prefix> Profile mode: also write per-set counts to\n\
+                   <prefix>-sets.csv, which 4KB regions evict which to\n\
+                   <prefix>-conflicts.csv and per-set reuse distances\n\
+                   to <prefix>-reuse.csv.\n\
+        -k <num>   Set sampling: simulate one set from each of <num>\n\
+                   strata of equal traffic and scale the counts up, with\n\
+                   95%% confidence bounds. Reads the trace file twice.\n\
+        -T <on:period[:warm]> Time sampling: simulate the first <on>\n\
+                   records of every <period>, after <warm> uncounted\n\
+                   ones, and scale the counts up with 95%% bounds.\n\
+        -f <kind[:degree[:latency]]> Prefetcher: next, stride or\n\
+                   stream, fetching <degree> blocks ahead; a prefetch\n\
+                   arrives <latency> accesses after it is issued\n\
+                   (default 16).\n\
+        -g <page:SETSxWAYS[:SETSxWAYS]> Also simulate an L1 and optional\n\
+                   L2 TLB for 4k or 2m pages, e.g. -g 4k:16x4:128x12.\n\
 ");
 }
 
 int parseParams(int argc, char*argv[]){
     bool has_s = false, has_E = false, has_b = false, has_t = false;
     int opt;
-    while ((opt = getopt(argc, argv, "hvs:E:b:t:")) != -1) {
+    while ((opt = getopt(argc, argv, "hvdms:E:b:t:w:j:p:l:i:W:A:P:k:T:f:g:")) != -1) {
         switch (opt) {
             case 'v':
                 v = true;
@@ -69,10 +131,94 @@ int parseParams(int argc, char*argv[]){
                 has_b = true;
                 break;
             case 't':
-                t = (char*) malloc(sizeof(char) * strlen(optarg));
-                sprintf(t, "%s", optarg);
+                t = optarg;
                 has_t = true;
                 break;
+            case 'w':
+                w = optarg;
+                break;
+            case 'j':
+                j = atoi(optarg);
+                if(j < 1) j = 1;
+                break;
+            case 'p':
+                for(policy=0;policy<NPOLICIES;policy++){
+                    if(strcmp(optarg, policyNames[policy]) == 0) break;
+                }
+                if(policy == NPOLICIES){
+                    printf("Unknown replacement policy: %s\n", optarg);
+                    printUsage();
+                    return -1;
+                }
+                break;
+            case 'd':
+                backingData = true;
+                break;
+            case 'm':
+                markers = true;
+                break;
+            case 'P':
+                profilePrefix = optarg;
+                break;
+            case 'k':
+                sampleSets = atoi(optarg);
+                if(sampleSets < 1){
+                    printf("-k needs at least one set.\n");
+                    return -1;
+                }
+                break;
+            case 'T':
+                windowSpec = optarg;
+                break;
+            case 'g':
+                if(tlb_parse(optarg, &tlbConfig) < 0){
+                    printf("Bad TLB: %s\n", optarg);
+                    printUsage();
+                    return -1;
+                }
+                break;
+            case 'f':
+                if(prefetch_parse(optarg, &prefetch) < 0){
+                    printf("Bad prefetcher: %s\n", optarg);
+                    printUsage();
+                    return -1;
+                }
+                break;
+            case 'W':
+                if(strcmp(optarg, "wb") && strcmp(optarg, "wt")){
+                    printf("Unknown write hit policy: %s\n", optarg);
+                    printUsage();
+                    return -1;
+                }
+                writeThrough = strcmp(optarg, "wt") == 0;
+                writeStats = true;
+                break;
+            case 'A':
+                if(strcmp(optarg, "wa") && strcmp(optarg, "nwa")){
+                    printf("Unknown write miss policy: %s\n", optarg);
+                    printUsage();
+                    return -1;
+                }
+                noWriteAllocate = strcmp(optarg, "nwa") == 0;
+                writeStats = true;
+                break;
+            case 'l':
+                if(nlevels == MAX_LEVELS){
+                    printf("At most %d cache levels are supported.\n", MAX_LEVELS);
+                    return -1;
+                }
+                levelSpecs[nlevels++] = optarg;
+                break;
+            case 'i':
+                for(inclusion=0;inclusion<NINCLUSIONS;inclusion++){
+                    if(strcmp(optarg, inclusionNames[inclusion]) == 0) break;
+                }
+                if(inclusion == NINCLUSIONS){
+                    printf("Unknown inclusion policy: %s\n", optarg);
+                    printUsage();
+                    return -1;
+                }
+                break;
             case 'h':
             case '?':
             default:
@@ -80,160 +226,994 @@ int parseParams(int argc, char*argv[]){
                 return -1;
         }
     }
+    if(w || nlevels) has_s = has_E = has_b = true;
     if(!has_s || !has_E || !has_b || !has_t){
         printUsage();
         return -1;
     }
+    if(!w && !nlevels && (s < 0 || s > 30 || E < 1 || b < 0 || s + b > 63)){
+        printf("Need 0 <= s <= 30, E >= 1, b >= 0 and s + b <= 63.\n");
+        return -1;
+    }
+    if(j > 1 && (v || w || nlevels)){
+        printf("-j splits the sets of one cache between threads; it does not combine with -v, -w or -l.\n");
+        return -1;
+    }
+    if(profilePrefix && (v || w || nlevels || j > 1)){
+        printf("Profile mode simulates one cache on one thread; it does not combine with -v, -w, -l or -j.\n");
+        return -1;
+    }
+    if((sampleSets || windowSpec) && (v || w || nlevels || j > 1 || profilePrefix)){
+        printf("Sampling simulates one cache on one thread; it does not combine with -v, -w, -l, -j or -P.\n");
+        return -1;
+    }
+    if(prefetch.kind != PF_NONE && (w || nlevels || j > 1 || profilePrefix || sampleSets || windowSpec)){
+        printf("Prefetchers are only modeled for a single cache; -f does not combine with -w, -l, -j, -P, -k or -T.\n");
+        return -1;
+    }
+    if(tlbConfig.pageBits && (w || profilePrefix || sampleSets || windowSpec)){
+        printf("The TLB runs alongside plain, -j and -l simulations; -g does not combine with -w, -P, -k or -T.\n");
+        return -1;
+    }
+    if(w && policy != LRU){
+        printf("Sweep mode relies on LRU stack distances; -p is not supported with -w.\n");
+        return -1;
+    }
+    if(policy == PLRU && (E > 64 || (E & (E - 1)))){
+        printf("Tree PLRU needs E to be a power of two no larger than 64.\n");
+        return -1;
+    }
     return 0;
 }
 
 Cache* cache;
 
-void initCache(){
-    cache = (Cache*) malloc(sizeof(Cache));
-    int S = pow(2, s);
-    int B = pow(2, b);
-    cache->sets = (Set*)malloc(sizeof(Set) * S);
-    for(int i=0;i<S;i++){
-        cache->sets[i].head = (Line*)malloc(sizeof(Line)); cache->sets[i].head->prev = NULL;
-        Line* p = cache->sets[i].head;
-        for(int j=0;j<E;j++){
-            Line* line = (Line*)malloc(sizeof(Line));
-            p->next = line; line->prev = p; p = p->next;
-            p->data = (char*)malloc(sizeof(char) * B); p->valid = false; p->tag = 0;
-        }
-        cache->sets[i].tail = (Line*)malloc(sizeof(Line)); cache->sets[i].tail->next = NULL;
-        p->next = cache->sets[i].tail; cache->sets[i].tail->prev = p;
+int openTrace(trace_reader_t* reader){
+    if(trace_open(reader, t) < 0){
+        printf("Open Trace File Failed.\n");
+        return -1;
     }
+    if(markers) trace_filter_markers(reader);
+    return 0;
 }
 
-void freeCache(){
-    int S = pow(2, s);
-    for(int i=0;i<S;i++){
-        Line* p = cache->sets[i].head;
-        for(int j=0;j<E;j++){
-            p = p->next;
-            p->prev->next = NULL; p->prev->prev = NULL; free(p->prev->data); p->prev->data; free(p->prev); p->prev = NULL;
-        }
-        p->prev = NULL; free(p->data); p->data = NULL; free(p); p = NULL;
+// closes reader, noting a -m run that never found tracegen's marker line
+void closeTrace(trace_reader_t* reader){
+    if(markers && !trace_markers_seen(reader) && !markersMissing){
+        printf("No " TRACE_MARKER_PREFIX "line in %s: -m needs a trace of tracegen.\n", t);
+        markersMissing = true;
     }
-    free(cache->sets); cache->sets = NULL;
-    free(cache); cache = NULL;
+    trace_close(reader);
 }
 
 Mode getMode(char c){
     if(c == 'M') return M;
     if(c == 'L') return L;
     if(c == 'S') return S;
+    return L;
 }
 
-int getInt(char c){
-    if(isdigit(c)) return c - '0';
-    return c-'a'+10;
+CacheStats total;
+
+const char* outcome[] = {"hit", "miss", "miss eviction"};
+
+// prints each access and its outcome for -v
+void printAccess(const trace_access_t* access, int first, int second, void* arg){
+    printf("%c %llx,%u %s", access->op, access->addr, access->size, outcome[first]);
+    if(second >= 0) printf(" %s", outcome[second]);
+    printf("\n");
+}
+
+void printTlb(const TlbStats* st){
+    printf("tlb lookups:%llu l1 misses:%llu l2 misses:%llu walks:%llu walk refs:%llu\n",
+           st->lookups, st->misses[0], st->misses[1], st->walks, st->walkRefs);
+}
+
+int simulate(){
+    CacheConfig cfg = {s, E, b, policy, writeThrough, noWriteAllocate, backingData, prefetch,
+                       tlbConfig};
+    trace_reader_t reader;
+    if(openTrace(&reader) < 0) return -1;
+    int ret = cachesim_run(&cfg, &reader, &total, v ? printAccess : NULL, NULL);
+    closeTrace(&reader);
+    return ret;
 }
 
-int tag, set_index, block_index;
+/*
+ * Parallel mode (-j): worker k owns every set with set % workers == k.
+ * The main thread parses the trace and hands each access to its owner
+ * through a single-producer single-consumer ring. The producer publishes
+ * its tail in batches; workers drain everything up to the published tail
+ * before releasing the slots. Shards are summed once every worker exits.
+ */
+#define RING_SIZE  4096     /* slots, a power of two */
+#define RING_BATCH 64       /* accesses per tail publication */
+
+typedef struct Request{
+    unsigned long long tag;
+    int set;
+    char op;                /* 'L', 'S' or 'M' */
+    unsigned size;
+} Request;
+
+typedef struct Ring{
+    unsigned head __attribute__((aligned(64)));  /* consumer position */
+    unsigned tail __attribute__((aligned(64)));  /* published producer position */
+    int done;
+    unsigned pending __attribute__((aligned(64))); /* producer's own position */
+    unsigned seen_head;                            /* producer's copy of head */
+    Shard shard;
+    pthread_t thread;
+    Request slots[RING_SIZE];
+} Ring;
+
+void ringPublish(Ring* r){
+    __atomic_store_n(&r->tail, r->pending, __ATOMIC_RELEASE);
+}
+
+void ringPush(Ring* r, Request req){
+    while(r->pending - r->seen_head == RING_SIZE){
+        ringPublish(r);
+        r->seen_head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        if(r->pending - r->seen_head == RING_SIZE) sched_yield();
+    }
+    r->slots[r->pending & (RING_SIZE - 1)] = req;
+    if(++r->pending % RING_BATCH == 0) ringPublish(r);
+}
 
-Line* find_tag(){
-    Line* p = cache->sets[set_index].head->next;
-    while(p->next){
-        if(p->tag == tag && p->valid){
-            return p;
+ALWAYS_INLINE
+void drain(Ring* r, const Policy p){
+    unsigned head = 0;
+    for(;;){
+        unsigned tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+        if(head == tail){
+            if(__atomic_load_n(&r->done, __ATOMIC_ACQUIRE) &&
+               head == __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE)) break;
+            sched_yield();
+            continue;
         }
-        p = p->next;
+        for(;head != tail;head++){
+            Request* req = &r->slots[head & (RING_SIZE - 1)];
+            if(req->op != 'S') load(cache, &r->shard, req->set, req->tag, p);
+            if(req->op != 'L') store(cache, &r->shard, req->set, req->tag, req->size, p);
+        }
+        __atomic_store_n(&r->head, head, __ATOMIC_RELEASE);
+    }
+}
+
+void* worker(void* arg){
+    Ring* r = arg;
+    switch(policy){
+    case LRU:    drain(r, LRU); break;
+    case FIFO:   drain(r, FIFO); break;
+    case LFU:    drain(r, LFU); break;
+    case RANDOM: drain(r, RANDOM); break;
+    case PLRU:   drain(r, PLRU); break;
+    case SRRIP:  drain(r, SRRIP); break;
+    case BRRIP:  drain(r, BRRIP); break;
+    default:     break;
     }
     return NULL;
 }
 
-int hits = 0, misses = 0, evictions = 0;
+int simulateParallel(){
+    int workers = s < 30 && j > (1 << s) ? (1 << s) : j;
+    Ring* rings;
+    trace_reader_t reader;
+    trace_access_t access;
 
-void move_to_head(Line* line){
-    Line* head = cache->sets[set_index].head;
-    line->prev->next = line->next; line->next->prev = line->prev;
-    line->prev = head; line->next = head->next; head->next = line; line->next->prev = line;
+    if(openTrace(&reader) < 0) return -1;
+    if(posix_memalign((void**)&rings, 64, sizeof(Ring) * workers)){
+        closeTrace(&reader);
+        return -1;
+    }
+    cache = newCache(s, E, b, policy, backingData);
+    cache->writeThrough = writeThrough;
+    cache->noWriteAllocate = noWriteAllocate;
+    memset(rings, 0, sizeof(Ring) * workers);
+    for(int k=0;k<workers;k++){
+        pthread_create(&rings[k].thread, NULL, worker, &rings[k]);
+    }
+    Tlb* tlb = tlbConfig.pageBits ? newTlb(&tlbConfig) : NULL;
+    while(trace_next(&reader, &access)){
+        unsigned long long tag;
+        int set_index = split(cache, access.addr, &tag);
+        if(tlb){
+            tlb_access(tlb, access.addr, access.size);
+            if(access.op == 'M') tlb_access(tlb, access.addr, access.size);
+        }
+        Request req = {tag, set_index, access.op, access.size};
+        ringPush(&rings[set_index % workers], req);
+    }
+    closeTrace(&reader);
+    for(int k=0;k<workers;k++){
+        ringPublish(&rings[k]);
+        __atomic_store_n(&rings[k].done, 1, __ATOMIC_RELEASE);
+    }
+    for(int k=0;k<workers;k++){
+        pthread_join(rings[k].thread, NULL);
+        cachesim_add(&total, &rings[k].shard);
+    }
+    if(tlb) total.tlb = tlb->stats;
+    freeTlb(tlb);
+    free(rings);
+    freeCache(cache);
+    return 0;
 }
 
-void load(){
-    Line* head = cache->sets[set_index].head;
-    Line* tail = cache->sets[set_index].tail;
-    Line* line = find_tag();
-    if(!line){
-        // miss
-        misses++;
-        bool hasEmpty = false;
-        Line* p = head->next;
-        while(p->next){
-            if(!p->valid){
-                hasEmpty = true;
-                break;
-            }
-            p = p->next;
-        }
-        if(!hasEmpty){
-            // eviction
-            evictions++;
-            line = tail->prev;
-            move_to_head(line);
-            line->tag = tag;
+/*
+ * Sweep mode: every configuration sharing (s, b) is served by one Mattson
+ * stack per set. The stack keeps the set's tags in LRU order, so the depth
+ * d at which an access finds its tag decides all associativities at once:
+ * it hits for every E > d. A miss evicts at associativity E whenever the
+ * set already held E distinct blocks. Recording a depth histogram and, for
+ * cold misses, a histogram of the set's fill gives every E's counts.
+ */
+typedef struct SweepConfig{
+    int s, E, b;
+    unsigned long long hits, misses, evictions;
+} SweepConfig;
+
+typedef struct SweepGroup{
+    int s, b, maxE;
+    unsigned long long* stacks;     /* S*maxE tags, most recently used first */
+    int* fill;                      /* number of tags in each set's stack */
+    unsigned long long* depth_hist; /* hits found at depth d < maxE */
+    unsigned long long* cold_hist;  /* misses that found fill f <= maxE */
+} SweepGroup;
+
+int parseRange(char* field, int* lo, int* hi){
+    char* end;
+    *lo = *hi = strtol(field, &end, 10);
+    if(*end == '-') *hi = strtol(end + 1, &end, 10);
+    return (end == field || *end || *lo > *hi) ? -1 : 0;
+}
+
+// expands the -w list into configs, returns the count or -1
+int parseSweep(char* list, SweepConfig** configs){
+    int n = 0, cap = 16;
+    char* spec = strdup(list);
+    *configs = malloc(sizeof(SweepConfig) * cap);
+    for(char* item = strtok(spec, ","); item; item = strtok(NULL, ",")){
+        char* fields[3];
+        int lo[3], hi[3];
+        fields[0] = item;
+        for(int i=1;i<3;i++){
+            fields[i] = strchr(fields[i-1], ':');
+            if(!fields[i]) goto bad;
+            *fields[i]++ = '\0';
+        }
+        for(int i=0;i<3;i++){
+            if(parseRange(fields[i], &lo[i], &hi[i]) < 0) goto bad;
+        }
+        if(lo[0] < 0 || lo[1] < 1 || lo[2] < 0 || hi[0] > 30 || hi[0] + hi[2] > 63) goto bad;
+        for(int cs=lo[0];cs<=hi[0];cs++)
+        for(int cE=lo[1];cE<=hi[1];cE++)
+        for(int cb=lo[2];cb<=hi[2];cb++){
+            if(n == cap) *configs = realloc(*configs, sizeof(SweepConfig) * (cap *= 2));
+            (*configs)[n++] = (SweepConfig){cs, cE, cb, 0, 0, 0};
+        }
+    }
+    free(spec);
+    return n;
+bad:
+    free(spec);
+    free(*configs);
+    return -1;
+}
+
+void sweepAccess(SweepGroup* g, unsigned long long addr){
+    unsigned long long tag = addr >> (g->s + g->b);
+    size_t set = (addr >> g->b) & (((size_t)1 << g->s) - 1);
+    unsigned long long* stack = g->stacks + set * g->maxE;
+    int fill = g->fill[set];
+    int d = 0;
+    while(d < fill && stack[d] != tag) d++;
+    if(d < fill){
+        g->depth_hist[d]++;
+    } else{
+        g->cold_hist[fill]++;
+        if(fill < g->maxE) g->fill[set] = ++fill;
+        d = fill - 1;
+    }
+    memmove(stack + 1, stack, sizeof(unsigned long long) * d);
+    stack[0] = tag;
+}
+
+int sweep(){
+    SweepConfig* configs;
+    SweepGroup* groups;
+    int n = parseSweep(w, &configs), ngroups = 0;
+    if(n < 0){
+        printf("Bad sweep list: %s\n", w);
+        printUsage();
+        return -1;
+    }
+
+    groups = malloc(sizeof(SweepGroup) * n);
+    for(int i=0;i<n;i++){
+        int j = 0;
+        while(j < ngroups && (groups[j].s != configs[i].s || groups[j].b != configs[i].b)) j++;
+        if(j == ngroups){
+            groups[ngroups++] = (SweepGroup){configs[i].s, configs[i].b, 0, NULL, NULL, NULL, NULL};
+        }
+        if(configs[i].E > groups[j].maxE) groups[j].maxE = configs[i].E;
+    }
+    for(int j=0;j<ngroups;j++){
+        SweepGroup* g = &groups[j];
+        g->stacks = malloc(sizeof(unsigned long long) * ((size_t)g->maxE << g->s));
+        g->fill = calloc((size_t)1 << g->s, sizeof(int));
+        g->depth_hist = calloc(g->maxE, sizeof(unsigned long long));
+        g->cold_hist = calloc(g->maxE + 1, sizeof(unsigned long long));
+    }
+
+    trace_reader_t reader;
+    trace_access_t access;
+    if(openTrace(&reader) < 0) return -1;
+    while(trace_next(&reader, &access)){
+        for(int j=0;j<ngroups;j++){
+            sweepAccess(&groups[j], access.addr);
+            if(access.op == 'M') sweepAccess(&groups[j], access.addr);
+        }
+    }
+    closeTrace(&reader);
+
+    printf("%4s %4s %4s %12s %12s %12s\n", "s", "E", "b", "hits", "misses", "evictions");
+    for(int i=0;i<n;i++){
+        SweepConfig* c = &configs[i];
+        SweepGroup* g = groups;
+        while(g->s != c->s || g->b != c->b) g++;
+        for(int d=0;d<g->maxE;d++){
+            if(d < c->E) c->hits += g->depth_hist[d];
+            else c->misses += g->depth_hist[d], c->evictions += g->depth_hist[d];
+        }
+        for(int f=0;f<=g->maxE;f++){
+            c->misses += g->cold_hist[f];
+            if(f >= c->E) c->evictions += g->cold_hist[f];
+        }
+        printf("%4d %4d %4d %12llu %12llu %12llu\n", c->s, c->E, c->b,
+               c->hits, c->misses, c->evictions);
+    }
+
+    for(int j=0;j<ngroups;j++){
+        free(groups[j].stacks); free(groups[j].fill);
+        free(groups[j].depth_hist); free(groups[j].cold_hist);
+    }
+    free(groups);
+    free(configs);
+    return 0;
+}
+
+
+/*
+ * Hierarchy mode (-l): a chain of levels, L1 first, sharing one block
+ * size. Stores are write-back and write-allocate: they dirty the L1 copy,
+ * and a dirty line evicted from a level is written to the level below it,
+ * or to memory from the last level. Each level's policy is dispatched at
+ * run time here, since every level may use a different one.
+ *
+ * inclusive: fills go to every level that missed, lowest first, and a
+ *            line evicted from a level is invalidated in the levels above.
+ * exclusive: a block lives in at most one level. Fills go to L1 only, a
+ *            hit below L1 moves the block up, and each level's victims
+ *            drop into the level below.
+ * nine:      fills go to every level that missed and no level constrains
+ *            another.
+ */
+Cache* levels[MAX_LEVELS];
+Shard levelStats[MAX_LEVELS];
+unsigned long long memWritebacks;
+
+static inline int blockSet(Cache* c, unsigned long long blk){
+    return blk & c->setMask;
+}
+
+static inline unsigned long long blockTag(Cache* c, unsigned long long blk){
+    return blk >> c->s;
+}
+
+static inline unsigned long long blockOf(Cache* c, int set, unsigned long long tag){
+    return tag << c->s | set;
+}
+
+int fillLevel(int i, unsigned long long blk, bool dirty);
+
+// hands a line evicted from level i to the level below
+void spill(int i, unsigned long long blk, bool dirty){
+    if(i + 1 == nlevels){
+        if(dirty) memWritebacks++;
+    } else if(inclusion == EXCLUSIVE || dirty){
+        Cache* next = levels[i + 1];
+        int way = find_tag(next, blockSet(next, blk), blockTag(next, blk));
+        if(way >= 0){
+            if(dirty) set_bit(next, next->dirty, blockSet(next, blk), way);
         } else{
-            p->valid = true; p->tag = tag;
-            move_to_head(p);
+            fillLevel(i + 1, blk, dirty);
+        }
+    }
+}
+
+// removes blk from the levels above i, returns whether any copy was dirty
+bool backInvalidate(int i, unsigned long long blk){
+    bool dirty = false;
+    for(int k=0;k<i;k++){
+        Cache* c = levels[k];
+        int set = blockSet(c, blk);
+        int way = find_tag(c, set, blockTag(c, blk));
+        if(way >= 0){
+            dirty |= test_bit(c, c->dirty, set, way);
+            clear_bit(c, c->valid, set, way);
+            clear_bit(c, c->dirty, set, way);
+            levelStats[k].invalidations++;
+        }
+    }
+    return dirty;
+}
+
+// places blk in level i and deals with the victim, returns the way used
+int fillLevel(int i, unsigned long long blk, bool dirty){
+    Cache* c = levels[i];
+    int set = blockSet(c, blk), victim_dirty;
+    unsigned long long victim;
+    int way = insert_block(c, &levelStats[i], set, blockTag(c, blk),
+                           &victim, &victim_dirty, c->policy);
+    if(dirty) set_bit(c, c->dirty, set, way);
+    if(victim_dirty >= 0){
+        unsigned long long victim_blk = blockOf(c, set, victim);
+        if(inclusion == INCLUSIVE && backInvalidate(i, victim_blk)){
+            if(!victim_dirty) levelStats[i].writebacks++;
+            victim_dirty = 1;
+        }
+        spill(i, victim_blk, victim_dirty);
+    }
+    return way;
+}
+
+void hierarchyAccess(unsigned long long blk, bool write){
+    int k, way = -1;
+    bool dirty = false;
+    for(k=0;k<nlevels;k++){
+        Cache* c = levels[k];
+        int set = blockSet(c, blk);
+        way = find_tag(c, set, blockTag(c, blk));
+        if(way >= 0){
+            levelStats[k].hits++;
+            on_hit(c, &levelStats[k], set, way, c->policy);
+            break;
+        }
+        levelStats[k].misses++;
+    }
+
+    if(inclusion == EXCLUSIVE){
+        if(k > 0 && k < nlevels){
+            Cache* c = levels[k];
+            int set = blockSet(c, blk);
+            dirty = test_bit(c, c->dirty, set, way);
+            clear_bit(c, c->valid, set, way);
+            clear_bit(c, c->dirty, set, way);
         }
+        if(k > 0) way = fillLevel(0, blk, dirty);
     } else{
-        // hit
-        hits++;
-        move_to_head(line);
+        for(int i=k-1;i>=0;i--) way = fillLevel(i, blk, false);
     }
+    if(write) set_bit(levels[0], levels[0]->dirty, blockSet(levels[0], blk), way);
 }
 
-void store(){
-    load();
+int hierarchy(){
+    trace_reader_t reader;
+    trace_access_t access;
+
+    for(int i=0;i<nlevels;i++){
+        int ls, lE, lb;
+        char name[16] = "lru";
+        Policy p;
+        if(sscanf(levelSpecs[i], "%d:%d:%d:%15s", &ls, &lE, &lb, name) < 3 ||
+           ls < 0 || lE < 1 || lb < 0 || ls > 30 || ls + lb > 63){
+            printf("Bad cache level: %s\n", levelSpecs[i]);
+            return -1;
+        }
+        for(p=0;p<NPOLICIES;p++){
+            if(strcmp(name, policyNames[p]) == 0) break;
+        }
+        if(p == NPOLICIES){
+            printf("Unknown replacement policy: %s\n", name);
+            return -1;
+        }
+        if(p == PLRU && (lE > 64 || (lE & (lE - 1)))){
+            printf("Tree PLRU needs E to be a power of two no larger than 64.\n");
+            return -1;
+        }
+        if(i > 0 && lb != levels[0]->b){
+            printf("All cache levels must use the same block size.\n");
+            return -1;
+        }
+        levels[i] = newCache(ls, lE, lb, p, backingData);
+    }
+
+    if(openTrace(&reader) < 0) return -1;
+    Tlb* tlb = tlbConfig.pageBits ? newTlb(&tlbConfig) : NULL;
+    while(trace_next(&reader, &access)){
+        unsigned long long blk = access.addr >> levels[0]->b;
+        Mode mode = getMode(access.op);
+        if(tlb){
+            tlb_access(tlb, access.addr, access.size);
+            if(mode == M) tlb_access(tlb, access.addr, access.size);
+        }
+        hierarchyAccess(blk, mode == S);
+        if(mode == M) hierarchyAccess(blk, true);
+    }
+    closeTrace(&reader);
+
+    printf("%-6s %4s %4s %4s %-7s %10s %10s %10s %10s %10s\n", "level", "s", "E", "b",
+           "policy", "hits", "misses", "evictions", "writebacks", "backinval");
+    for(int i=0;i<nlevels;i++){
+        Cache* c = levels[i];
+        Shard* st = &levelStats[i];
+        printf("L%-5d %4d %4d %4d %-7s %10llu %10llu %10llu %10llu %10llu\n", i + 1, c->s, c->E, c->b,
+               policyNames[c->policy], st->hits, st->misses, st->evictions,
+               st->writebacks, st->invalidations);
+        freeCache(c);
+    }
+    printf("memory writebacks: %llu (%s)\n", memWritebacks, inclusionNames[inclusion]);
+    if(tlb) printTlb(&tlb->stats);
+    freeTlb(tlb);
+    return 0;
 }
 
-void modify(){
-    load(); store();
+/*
+ * Profile mode (-P): simulates like simulate() does, but also counts hits,
+ * misses and evictions per set; for every eviction, the 4KB region of the
+ * block coming in and of the one going out; and the reuse distance of each
+ * access, the number of distinct blocks its set saw since the last access
+ * to the same block. Distances come from a move-to-front stack per set as
+ * in sweep mode, reuseDepth deep; an access at distance d hits under LRU
+ * for every E > d. Deeper reuses and first accesses count as "far".
+ */
+#define REGION_BITS 12
+
+typedef struct Conflict{
+    unsigned long long in, out;     /* regions; in is stored + 1 so 0 marks a free slot */
+    unsigned long long count;
+} Conflict;
+
+unsigned long long* setStats;       /* hits, misses and evictions of each set */
+Conflict* conflicts;                /* open addressing, capacity a power of two */
+size_t nconflicts, conflictCapacity;
+unsigned long long* reuseStacks;    /* reuseDepth tags per set, most recent first */
+int* reuseFill;
+int reuseDepth;
+unsigned long long* reuseHist;      /* reuseDepth distances, then "far" */
+
+void addConflict(unsigned long long in, unsigned long long out, unsigned long long count){
+    if(2 * (nconflicts + 1) > conflictCapacity){
+        Conflict* old = conflicts;
+        size_t oldCapacity = conflictCapacity;
+        conflictCapacity = 2 * oldCapacity;
+        conflicts = calloc(conflictCapacity, sizeof(Conflict));
+        nconflicts = 0;
+        for(size_t i=0;i<oldCapacity;i++){
+            if(old[i].in) addConflict(old[i].in - 1, old[i].out, old[i].count);
+        }
+        free(old);
+    }
+    size_t h = (in * 0x9e3779b97f4a7c15ULL ^ out) * 0xff51afd7ed558ccdULL >> 17;
+    for(;;h++){
+        Conflict* c = &conflicts[h & (conflictCapacity - 1)];
+        if(!c->in){
+            *c = (Conflict){in + 1, out, 0};
+            nconflicts++;
+        }
+        if(c->in == in + 1 && c->out == out){
+            c->count += count;
+            return;
+        }
+    }
 }
 
-int simulate(){
-    FILE* fd = fopen(t, "r");
-    if(!fd){
-        printf("Open Trace File Failed.\n");
-        return -1;
+void addReuse(int set, unsigned long long tag){
+    unsigned long long* stack = reuseStacks + (size_t)set * reuseDepth;
+    int fill = reuseFill[set];
+    int d = 0;
+    while(d < fill && stack[d] != tag) d++;
+    reuseHist[d < fill ? d : reuseDepth]++;
+    if(d == fill){
+        if(fill < reuseDepth) reuseFill[set] = ++fill;
+        d = fill - 1;
+    }
+    memmove(stack + 1, stack, sizeof(unsigned long long) * d);
+    stack[0] = tag;
+}
+
+// one load or store, as load() and store() do it but seeing the victim
+void profileAccess(Shard* sh, unsigned long long addr, bool write, unsigned size){
+    unsigned long long tag;
+    int set = split(cache, addr, &tag);
+    unsigned long long* st = setStats + (size_t)set * 3;
+    int way = find_tag(cache, set, tag);
+
+    addReuse(set, tag);
+    if(way >= 0){
+        sh->hits++;
+        st[0]++;
+        on_hit(cache, sh, set, way, cache->policy);
+    } else{
+        sh->misses++;
+        st[1]++;
+        if(!write || !cache->noWriteAllocate){
+            unsigned long long victim;
+            int victim_dirty;
+            way = insert_block(cache, sh, set, tag, &victim, &victim_dirty, cache->policy);
+            if(victim_dirty >= 0){
+                st[2]++;
+                addConflict(addr >> REGION_BITS,
+                            (blockOf(cache, set, victim) << b) >> REGION_BITS, 1);
+            }
+        }
+    }
+    if(!write) return;
+    if(way >= 0 && !cache->writeThrough){
+        set_bit(cache, cache->dirty, set, way);
+    } else{
+        sh->memwrites++;
+        sh->memwriteBytes += size;
+    }
+}
+
+int byCount(const void* x, const void* y){
+    const Conflict* p = x;
+    const Conflict* q = y;
+    return p->count < q->count ? 1 : p->count > q->count ? -1 : 0;
+}
+
+FILE* openProfile(const char* suffix){
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s-%s.csv", profilePrefix, suffix);
+    FILE* fp = fopen(path, "w");
+    if(!fp) printf("Cannot write %s\n", path);
+    return fp;
+}
+
+int writeProfile(){
+    FILE* fp;
+    size_t n = 0;
+
+    if(!(fp = openProfile("sets"))) return -1;
+    fprintf(fp, "set,hits,misses,evictions\n");
+    for(size_t i=0;i<(size_t)1 << s;i++){
+        unsigned long long* st = setStats + i * 3;
+        fprintf(fp, "%zu,%llu,%llu,%llu\n", i, st[0], st[1], st[2]);
+    }
+    fclose(fp);
+
+    if(!(fp = openProfile("conflicts"))) return -1;
+    for(size_t i=0;i<conflictCapacity;i++){
+        if(conflicts[i].in) conflicts[n++] = conflicts[i];
+    }
+    qsort(conflicts, n, sizeof(Conflict), byCount);
+    fprintf(fp, "evictor,victim,evictions\n");
+    for(size_t i=0;i<n;i++){
+        fprintf(fp, "0x%llx,0x%llx,%llu\n", (conflicts[i].in - 1) << REGION_BITS,
+                conflicts[i].out << REGION_BITS, conflicts[i].count);
+    }
+    fclose(fp);
+
+    if(!(fp = openProfile("reuse"))) return -1;
+    fprintf(fp, "distance,accesses\n");
+    for(int d=0;d<reuseDepth;d++) fprintf(fp, "%d,%llu\n", d, reuseHist[d]);
+    fprintf(fp, "far,%llu\n", reuseHist[reuseDepth]);
+    fclose(fp);
+    return 0;
+}
+
+int profile(){
+    trace_reader_t reader;
+    trace_access_t access;
+    Shard sh = {0};
+    size_t S = (size_t)1 << s;
+    int ret;
+
+    reuseDepth = 2 * E < 16 ? 16 : 2 * E > 256 ? 256 : 2 * E;
+    if(openTrace(&reader) < 0) return -1;
+    cache = newCache(s, E, b, policy, backingData);
+    cache->writeThrough = writeThrough;
+    cache->noWriteAllocate = noWriteAllocate;
+    setStats = calloc(S * 3, sizeof(unsigned long long));
+    reuseStacks = malloc(S * reuseDepth * sizeof(unsigned long long));
+    reuseFill = calloc(S, sizeof(int));
+    reuseHist = calloc(reuseDepth + 1, sizeof(unsigned long long));
+    conflictCapacity = 1024;
+    conflicts = calloc(conflictCapacity, sizeof(Conflict));
+    while(trace_next(&reader, &access)){
+        if(access.op != 'S') profileAccess(&sh, access.addr, false, access.size);
+        if(access.op != 'L') profileAccess(&sh, access.addr, true, access.size);
     }
-    char* cmd = NULL;
-    size_t len;
-    while(getline(&cmd, &len, fd) != -1){
-        if(cmd[0] == 'I') continue;
-        int size = 0, addr = 0, i = 3;
-        while(cmd[i] != ',') {addr *= 16; addr += getInt(cmd[i]); i++;}
-        while(cmd[++i] != '\n') {size *= 16; size += getInt(cmd[i]);}
-        // printf("%s %d %d\n", cmd, size, addr);
-        tag = addr >> (s+b);
-        set_index = (addr^(tag << (s+b))) >> b;
-        block_index = addr&(~(-1>>b<<b));
-        printf("%d %d %d\n", tag, set_index, block_index);
-        switch(getMode(cmd[1])){
-        case M:
-            modify(); break;
-        case S:
-            store(); break;
-        case L:
-            load(); break;
+    closeTrace(&reader);
+    cachesim_add(&total, &sh);
+
+    ret = writeProfile();
+    freeCache(cache);
+    free(setStats);
+    free(conflicts);
+    free(reuseStacks);
+    free(reuseFill);
+    free(reuseHist);
+    return ret;
+}
+
+/*
+ * Sampling mode (-k, -T): simulates part of the trace and scales the
+ * counts up to the whole run, with 95% confidence bounds.
+ *
+ * -k n simulates n of the S sets. A first pass over the trace counts the
+ * accesses to every set; the sets, ordered by that traffic, are cut into
+ * n strata of about equal traffic, so a hot set is a stratum of its own,
+ * and a seeded draw simulates one set of each. A stratum's counts are
+ * those of its set scaled by the stratum's traffic over the set's. For
+ * the bounds, the spread of hit, miss, ... rates per access between the
+ * simulated sets of all strata of more than one set stands in for the
+ * spread within each of them.
+ * The first pass needs a trace file that can be read twice.
+ *
+ * -T on:period[:warm] simulates the first on records of every period. The
+ * warm records before each window are simulated too, to refresh the
+ * cache, but not counted; the rest are skipped without being parsed.
+ * Counts are scaled by records seen over records counted, a ratio
+ * estimate whose bounds come from the spread between windows. With both
+ * options, the windows give the bounds and the choice of sets is not
+ * covered by them.
+ */
+unsigned long long windowOn, windowPeriod, windowWarm;
+
+#define NCOUNTS 6   /* hits, misses, evictions, writebacks, memwrites, memwriteBytes */
+
+// the counts of one sampling unit, a stratum of sets or a window
+typedef struct Unit{
+    double n[NCOUNTS];
+    unsigned long long records;
+} Unit;
+
+// sets of similar traffic, one of which is simulated
+typedef struct Stratum{
+    int size;                   /* sets in the stratum */
+    unsigned long long traffic; /* accesses to all of them */
+    unsigned long long sampled; /* accesses to the simulated one */
+    double weight;              /* factor from its counts to the stratum's */
+} Stratum;
+
+unsigned long long* setTraffic;
+
+void addShard(Unit* u, const Shard* after, const Shard* before, double weight){
+    u->n[0] += weight * (after->hits - before->hits);
+    u->n[1] += weight * (after->misses - before->misses);
+    u->n[2] += weight * (after->evictions - before->evictions);
+    u->n[3] += weight * (after->writebacks - before->writebacks);
+    u->n[4] += weight * (after->memwrites - before->memwrites);
+    u->n[5] += weight * (after->memwriteBytes - before->memwriteBytes);
+}
+
+/*
+ * estimate - The whole-run estimate of count i from n units, and in
+ *     *bound the half-width of its 95% confidence interval, NAN if the
+ *     sample cannot tell. records is the number of records in the trace.
+ */
+double estimate(Unit* units, Stratum* strata, size_t n, int i, unsigned long long records,
+                double* bound){
+    double sum = 0, sumsq = 0;
+    *bound = 0;
+    if(windowPeriod){
+        double counted = 0;
+        for(size_t k=0;k<n;k++){
+            sum += units[k].n[i];
+            counted += units[k].records;
+        }
+        if(counted == 0) return 0;
+        double ratio = sum / counted;
+        for(size_t k=0;k<n;k++){
+            double e = units[k].n[i] - ratio * units[k].records;
+            sumsq += e * e;
         }
+        if(n > 1){
+            double mean = counted / n;
+            double f = counted / records;
+            *bound = 1.96 * records / mean * sqrt((1 - f) * sumsq / (n - 1) / n);
+        }
+        return ratio * records;
     }
+
+    // the strata of several sets share one spread of per-access rates, taken from all of them
+    double rsum = 0, rsumsq = 0, tsq = 0;
+    size_t m = 0;
+    for(size_t k=0;k<n;k++){
+        const Stratum* h = &strata[k];
+        sum += h->weight * units[k].n[i];
+        if(h->size == 1) continue;
+        double r = h->sampled ? units[k].n[i] / h->sampled : 0;
+        rsum += r;
+        rsumsq += r * r;
+        tsq += (1 - 1.0 / h->size) * (double)h->traffic * h->traffic;
+        m++;
+    }
+    if(m == 1) *bound = NAN;
+    if(m > 1){
+        double var = (rsumsq - rsum * rsum / m) / (m - 1);
+        *bound = 1.96 * sqrt(tsq * (var > 0 ? var : 0));
+    }
+    return sum;
+}
+
+int byTraffic(const void* x, const void* y){
+    unsigned long long p = setTraffic[*(const int*)x], q = setTraffic[*(const int*)y];
+    return p > q ? -1 : p < q;
+}
+
+/*
+ * stratify - Cut the S sets into k strata of about equal traffic and
+ *     draw one set of each, recording its stratum in slot[]
+ */
+void stratify(size_t S, int k, Stratum* strata, int* slot){
+    int* order = malloc(sizeof(int) * S);
+    unsigned long long left = 0, traffic = 0, rng = 15213;
+    size_t first = 0;
+    int h = 0;
+
+    for(size_t i=0;i<S;i++){
+        order[i] = i;
+        slot[i] = -1;
+        left += setTraffic[i];
+    }
+    qsort(order, S, sizeof(int), byTraffic);
+    for(size_t i=0;i<S;i++){
+        traffic += setTraffic[order[i]];
+        if(i + 1 < S && (h == k - 1 ||
+                         (traffic * (k - h) < left && S - i - 1 > (size_t)(k - h - 1))))
+            continue;
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        int set = order[first + rng % (i - first + 1)];
+        Stratum* st = &strata[h];
+        st->size = i - first + 1;
+        st->traffic = traffic;
+        st->sampled = setTraffic[set];
+        st->weight = st->sampled ? (double)traffic / st->sampled : st->size;
+        slot[set] = h++;
+        left -= traffic;
+        traffic = 0;
+        first = i + 1;
+    }
+    free(order);
+}
+
+// counts the accesses to every set into setTraffic
+int countTraffic(){
+    trace_reader_t reader;
+    trace_access_t access;
+    struct stat st;
+
+    if(strcmp(t, "-") == 0 || stat(t, &st) < 0 || !S_ISREG(st.st_mode)){
+        printf("-k reads the trace twice and needs a regular file, not %s.\n", t);
+        return -1;
+    }
+    if(openTrace(&reader) < 0) return -1;
+    while(trace_next(&reader, &access)){
+        unsigned long long tag;
+        setTraffic[split(cache, access.addr, &tag)] += access.op == 'M' ? 2 : 1;
+    }
+    closeTrace(&reader);
     return 0;
 }
 
+int parseWindows(){
+    int fields = sscanf(windowSpec, "%llu:%llu:%llu", &windowOn, &windowPeriod, &windowWarm);
+    if(fields < 2 || windowOn < 1 || windowPeriod < windowOn ||
+       windowWarm > windowPeriod - windowOn){
+        printf("Bad window spec %s: need on:period[:warm] with 1 <= on <= period and on + warm <= period.\n",
+               windowSpec);
+        return -1;
+    }
+    return 0;
+}
+
+int sample(){
+    trace_reader_t reader;
+    trace_access_t access;
+    Shard sh = {0};
+    size_t S = (size_t)1 << s, n = 0, cap = 1024;
+    int k = sampleSets > 0 && (size_t)sampleSets < S ? sampleSets : (int)S;
+    int* slot = malloc(sizeof(int) * S);
+    Stratum* strata = calloc(k, sizeof(Stratum));
+    Unit* units;
+    unsigned long long records = 0;
+    int ret = -1, whole = 0;
+
+    setTraffic = calloc(S, sizeof(unsigned long long));
+    cache = newCache(s, E, b, policy, backingData);
+    cache->writeThrough = writeThrough;
+    cache->noWriteAllocate = noWriteAllocate;
+    if(windowSpec && parseWindows() < 0) goto out;
+    if((size_t)k < S && countTraffic() < 0) goto out;
+    stratify(S, k, strata, slot);
+    if(openTrace(&reader) < 0) goto out;
+    for(int i=0;i<k;i++) whole += strata[i].size == 1;
+    if(!windowPeriod) cap = n = k;
+    units = calloc(cap, sizeof(Unit));
+
+    while(trace_next(&reader, &access)){
+        unsigned long long tag, phase = 0;
+        if(windowPeriod){
+            phase = records % windowPeriod;
+            if(phase == 0){
+                if(n == cap) units = realloc(units, sizeof(Unit) * (cap *= 2));
+                memset(&units[n++], 0, sizeof(Unit));
+            }
+        }
+        records++;
+        // the records between a window and the next one's warm-up are only counted
+        if(windowPeriod && phase == windowOn - 1)
+            records += trace_skip(&reader, windowPeriod - windowOn - windowWarm);
+        if(windowPeriod && phase < windowOn) units[n - 1].records++;
+        int set = split(cache, access.addr, &tag);
+        if(slot[set] < 0) continue;
+        Shard before = sh;
+        if(access.op != 'S') load(cache, &sh, set, tag, cache->policy);
+        if(access.op != 'L') store(cache, &sh, set, tag, access.size, cache->policy);
+        if(!windowPeriod) addShard(&units[slot[set]], &sh, &before, 1);
+        else if(phase < windowOn) addShard(&units[n - 1], &sh, &before, strata[slot[set]].weight);
+    }
+    closeTrace(&reader);
+
+    double est[NCOUNTS], bound[NCOUNTS];
+    for(int i=0;i<NCOUNTS;i++) est[i] = estimate(units, strata, n, i, records, &bound[i]);
+    total.hits = llround(est[0]);
+    total.misses = llround(est[1]);
+    total.evictions = llround(est[2]);
+    total.writebacks = llround(est[3]);
+    total.memwrites = llround(est[4]);
+    total.memwriteBytes = llround(est[5]);
+
+    printf("sampled %d of %zu sets", k, S);
+    if((size_t)k < S) printf(" (%d hot enough to be strata of their own)", whole);
+    if(windowPeriod) printf(", %llu of every %llu records (%zu windows)", windowOn, windowPeriod, n);
+    if(isnan(bound[0])) printf("; too few strata for 95%% bounds\n");
+    else{
+        printf("; 95%% bounds");
+        if(!windowPeriod && whole < k) printf(" from the spread of %d strata", k - whole);
+        printf(": hits +-%.0f misses +-%.0f evictions +-%.0f\n", bound[0], bound[1], bound[2]);
+    }
+    free(units);
+    ret = 0;
+out:
+    free(setTraffic);
+    free(strata);
+    free(slot);
+    freeCache(cache);
+    return ret;
+}
 
 int main(int argc, char* argv[])
 {
     int ret;
     ret = parseParams(argc, argv);
     if(ret == -1) return -1;
-    initCache();
-    if(simulate() >= 0){
-        printSummary(hits, misses, evictions);
+    if(w || nlevels){
+        ret = w ? sweep() : hierarchy();
+        return markersMissing ? 1 : ret;
+    }
+    if(profilePrefix) ret = profile();
+    else if(sampleSets || windowSpec) ret = sample();
+    else ret = j > 1 ? simulateParallel() : simulate();
+    if(markersMissing) return 1;
+    if(ret >= 0){
+        printSummary(total.hits, total.misses, total.evictions);
+        if(writeStats || v)
+            printf("dirty evictions:%llu bytes written back:%llu memory writes:%llu bytes:%llu\n",
+                   total.writebacks, total.writebacks << b,
+                   total.memwrites, total.memwriteBytes);
+        if(prefetch.kind != PF_NONE)
+            printf("prefetches issued:%llu useful:%llu late:%llu polluting:%llu evictions:%llu dirty evictions:%llu\n",
+                   total.pfIssued, total.pfUseful, total.pfLate, total.pfPolluting,
+                   total.pfEvictions, total.pfWritebacks);
+        if(tlbConfig.pageBits) printTlb(&total.tlb);
     }
-    freeCache();
     return 0;
 }
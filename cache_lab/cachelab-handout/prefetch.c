@@ -0,0 +1,229 @@
+/*
+ * prefetch.c - Next-line, stride and stream prefetchers
+ *
+ * Stride and stream prefetchers see no instruction addresses, so they
+ * tell access streams apart by address alone: a tracker follows the
+ * demand accesses that land within PF_WINDOW blocks of its last one.
+ */
+#include "cachesim.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#define PF_TRACKERS 16
+#define PF_WINDOW   16      /* blocks a tracker looks either side of its last access */
+#define PF_QUEUE    64
+#define PF_FILTER   4096    /* slots of the pollution filter, a power of two */
+#define PF_PAGE_BITS 12
+
+const char* prefetchNames[NPREFETCHERS] = {"none", "next", "stride", "stream"};
+
+static const int defaultDegree[NPREFETCHERS] = {0, 1, 2, 4};
+
+#define DEFAULT_LATENCY 16
+
+typedef struct Tracker{
+    long long last;         /* last block */
+    long long delta;        /* stride, or the direction of a stream */
+    long long ahead;        /* furthest block a stream has prefetched */
+    int conf;
+    unsigned long long used;
+} Tracker;
+
+typedef struct Pending{
+    unsigned long long blk;
+    unsigned long long issued;
+} Pending;
+
+typedef struct Prefetcher{
+    PrefetchConfig cfg;
+    unsigned long long now;             /* demand accesses so far */
+    int npending;
+    Pending pending[PF_QUEUE];
+    Tracker trackers[PF_TRACKERS];
+    unsigned long long victims[PF_FILTER];  /* demand blocks evicted by prefetches, + 1 */
+    unsigned long long issued[];        /* per line, when an unused prefetch of it was issued, + 1 */
+} Prefetcher;
+
+int prefetch_parse(const char* spec, PrefetchConfig* cfg){
+    char name[16];
+    int degree = -1, latency = -1;
+    int fields = sscanf(spec, "%15[a-z]:%d:%d", name, &degree, &latency);
+    if(fields < 1) return -1;
+    for(cfg->kind=0;cfg->kind<NPREFETCHERS;cfg->kind++){
+        if(strcmp(name, prefetchNames[cfg->kind]) == 0) break;
+    }
+    if(cfg->kind == NPREFETCHERS) return -1;
+    if(fields >= 2 && (degree < 1 || degree > PF_QUEUE / 2)) return -1;
+    if(fields >= 3 && latency < 0) return -1;
+    cfg->degree = fields >= 2 ? degree : defaultDegree[cfg->kind];
+    cfg->latency = fields >= 3 ? latency : DEFAULT_LATENCY;
+    return 0;
+}
+
+void prefetch_attach(Cache* c, const PrefetchConfig* cfg){
+    size_t lines = ((size_t)1 << c->s) * c->E;
+    Prefetcher* pf = calloc(1, sizeof(Prefetcher) + lines * sizeof(unsigned long long));
+    pf->cfg = *cfg;
+    c->prefetch = pf;
+}
+
+static inline size_t filter_slot(unsigned long long blk){
+    return (blk * 0x9e3779b97f4a7c15ULL) >> 52 & (PF_FILTER - 1);
+}
+
+// queues blk if it is on trigger's page
+static void enqueue(Prefetcher* pf, Cache* c, long long trigger, long long blk){
+    int shift = PF_PAGE_BITS > c->b ? PF_PAGE_BITS - c->b : 0;
+    if(blk < 0 || blk >> shift != trigger >> shift || pf->npending == PF_QUEUE) return;
+    pf->pending[pf->npending++] = (Pending){blk, pf->now};
+}
+
+void prefetch_issue(Cache* c, Shard* sh){
+    Prefetcher* pf = c->prefetch;
+    Shard fill = {0};       /* keeps prefetch evictions out of the demand counts */
+    for(int i=0;i<pf->npending;i++){
+        unsigned long long blk = pf->pending[i].blk, victim;
+        int set = blk & c->setMask, victim_dirty;
+        unsigned long long tag = blk >> c->s;
+        if(find_tag(c, set, tag) >= 0) continue;
+        int way = insert_block(c, &fill, set, tag, &victim, &victim_dirty, c->policy);
+        size_t line = (size_t)set * c->E + way;
+        if(victim_dirty >= 0 && !pf->issued[line]){
+            unsigned long long vblk = victim << c->s | set;
+            pf->victims[filter_slot(vblk)] = vblk + 1;
+        }
+        pf->issued[line] = pf->pending[i].issued + 1;
+        sh->pfIssued++;
+    }
+    pf->npending = 0;
+    sh->pfEvictions += fill.evictions;
+    sh->pfWritebacks += fill.writebacks;
+}
+
+// the tracker whose last block is nearest blk within PF_WINDOW, or NULL
+static Tracker* nearest(Prefetcher* pf, long long blk){
+    Tracker* best = NULL;
+    long long bestDist = PF_WINDOW + 1;
+    for(int i=0;i<PF_TRACKERS;i++){
+        Tracker* t = &pf->trackers[i];
+        long long dist = llabs(blk - t->last);
+        if(t->used && dist < bestDist){
+            best = t;
+            bestDist = dist;
+        }
+    }
+    return best;
+}
+
+static Tracker* allocate(Prefetcher* pf, long long blk){
+    Tracker* t = &pf->trackers[0];
+    for(int i=1;i<PF_TRACKERS;i++){
+        if(pf->trackers[i].used < t->used) t = &pf->trackers[i];
+    }
+    *t = (Tracker){blk, 0, blk, 0, pf->now};
+    return t;
+}
+
+static void train_stride(Prefetcher* pf, Cache* c, long long blk){
+    Tracker* t = NULL;
+    for(int i=0;i<PF_TRACKERS && !t;i++){
+        Tracker* u = &pf->trackers[i];
+        if(u->used && u->delta && u->last + u->delta == blk) t = u;
+    }
+    if(t){
+        if(t->conf < 3) t->conf++;
+    } else if((t = nearest(pf, blk))){
+        if(t->last == blk){
+            t->used = pf->now;
+            return;
+        }
+        t->delta = blk - t->last;
+        t->conf = 0;
+    } else{
+        t = allocate(pf, blk);
+    }
+    t->last = blk;
+    t->used = pf->now;
+    if(t->conf >= 1){
+        for(int k=1;k<=pf->cfg.degree;k++) enqueue(pf, c, blk, blk + k * t->delta);
+    }
+}
+
+static void train_stream(Prefetcher* pf, Cache* c, long long blk, bool hit){
+    Tracker* t = nearest(pf, blk);
+    if(!t){
+        if(!hit) allocate(pf, blk);
+        return;
+    }
+    t->used = pf->now;
+    if(blk == t->last) return;
+    long long dir = blk > t->last ? 1 : -1;
+    if(dir == t->delta){
+        t->conf++;
+    } else{
+        t->delta = dir;
+        t->conf = 1;
+        t->ahead = blk;
+    }
+    t->last = blk;
+    if(t->conf < 2) return;
+    long long target = blk + dir * pf->cfg.degree;
+    long long from = (t->ahead - blk) * dir > 0 ? t->ahead : blk;
+    for(long long next=from+dir;(target - next) * dir >= 0;next+=dir) enqueue(pf, c, blk, next);
+    t->ahead = target;
+}
+
+// queue the blocks predicted by a demand access to blk
+static void train(Prefetcher* pf, Cache* c, long long blk, bool hit, bool firstUse){
+    switch(pf->cfg.kind){
+    case PF_NEXTLINE:
+        if(!hit || firstUse){
+            for(int k=1;k<=pf->cfg.degree;k++) enqueue(pf, c, blk, blk + k);
+        }
+        break;
+    case PF_STRIDE: train_stride(pf, c, blk); break;
+    case PF_STREAM: train_stream(pf, c, blk, hit); break;
+    default:        break;
+    }
+}
+
+// a demand miss on blk: was blk pushed out by a prefetch?
+static void check_pollution(Prefetcher* pf, Shard* sh, unsigned long long blk){
+    size_t slot = filter_slot(blk);
+    if(pf->victims[slot] == blk + 1){
+        sh->pfPolluting++;
+        pf->victims[slot] = 0;
+    }
+}
+
+void prefetch_train(Cache* c, Shard* sh, int set, int way, bool hit){
+    Prefetcher* pf = c->prefetch;
+    size_t line = (size_t)set * c->E + way;
+    unsigned long long blk = c->tags[line] << c->s | set;
+    bool firstUse = false;
+
+    pf->now++;
+    if(hit){
+        if(pf->issued[line]){
+            if(pf->now - pf->issued[line] + 1 < (unsigned long long)pf->cfg.latency) sh->pfLate++;
+            else sh->pfUseful++;
+            pf->issued[line] = 0;
+            firstUse = true;
+        }
+    } else{
+        pf->issued[line] = 0;
+        check_pollution(pf, sh, blk);
+    }
+    train(pf, c, blk, hit, firstUse);
+}
+
+void prefetch_train_bypass(Cache* c, Shard* sh, int set, unsigned long long tag){
+    Prefetcher* pf = c->prefetch;
+    unsigned long long blk = tag << c->s | set;
+
+    pf->now++;
+    check_pollution(pf, sh, blk);
+    train(pf, c, blk, false, false);
+}
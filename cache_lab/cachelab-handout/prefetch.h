@@ -0,0 +1,69 @@
+/*
+ * prefetch.h - Hardware prefetcher models for the cache model
+ *
+ * A prefetcher is attached to a Cache and trained by every demand access,
+ * including store misses that no-write-allocate sends past the cache. The blocks it predicts are queued and
+ * filled into the same cache just before the next demand access, so they
+ * compete with demand lines under the cache's replacement policy. Like
+ * hardware prefetchers working on physical addresses, none of them
+ * crosses a 4KB page.
+ *
+ * Each prefetch that fills a line counts as issued. Its fate is then
+ *
+ *     useful      the first demand access to the line came at least
+ *                 latency demand accesses after the prefetch was issued
+ *     late        it came sooner, while the fill would still be in flight
+ *
+ * or neither, if the line is evicted unused. A prefetch that evicts a
+ * demand line is polluting if that line misses again while it is still
+ * in a small direct-mapped filter of such victims. The evictions and
+ * writebacks of prefetch fills are counted apart from the demand ones,
+ * so hits, misses and evictions stay comparable with a run without -f.
+ */
+
+#ifndef CACHELAB_PREFETCH_H
+#define CACHELAB_PREFETCH_H
+
+#include <stdbool.h>
+
+typedef enum PrefetchKind{
+    PF_NONE,
+    PF_NEXTLINE,    /* the next degree blocks after a miss or a first use of a prefetch */
+    PF_STRIDE,      /* degree strides ahead once an address delta repeats */
+    PF_STREAM,      /* runs degree blocks ahead of an ascending or descending run */
+    NPREFETCHERS,
+} PrefetchKind;
+
+extern const char* prefetchNames[NPREFETCHERS];
+
+typedef struct PrefetchConfig{
+    PrefetchKind kind;
+    int degree;
+    int latency;    /* demand accesses a prefetch takes to arrive */
+} PrefetchConfig;
+
+struct Cache;
+struct Shard;
+
+/*
+ * Parse "kind[:degree[:latency]]", e.g. "stream:8". Missing fields get the
+ * kind's defaults. Returns 0 on success and -1 on a bad spec.
+ */
+int prefetch_parse(const char* spec, PrefetchConfig* cfg);
+
+/* Attach a prefetcher built from cfg to c; freeCache() frees it */
+void prefetch_attach(struct Cache* c, const PrefetchConfig* cfg);
+
+/* Fill the blocks queued by the last demand access */
+void prefetch_issue(struct Cache* c, struct Shard* sh);
+
+/* Account for a demand access that hit or filled way of set, and train on it */
+void prefetch_train(struct Cache* c, struct Shard* sh, int set, int way, bool hit);
+
+/*
+ * Account for a demand miss on tag in set that was not filled (a store
+ * under no-write-allocate), and train on it as on any other miss
+ */
+void prefetch_train_bypass(struct Cache* c, struct Shard* sh, int set, unsigned long long tag);
+
+#endif /* CACHELAB_PREFETCH_H */
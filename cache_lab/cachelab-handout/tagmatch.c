@@ -0,0 +1,67 @@
+/*
+ * tagmatch.c - Scalar and AVX2 set tag lookup kernels
+ */
+#include "tagmatch.h"
+
+#include <immintrin.h>
+
+/* Below two groups of ways the AVX2 kernel only adds setup overhead */
+#define AVX2_MIN_WAYS 16
+
+/*
+ * tagmatch_scalar - Check each way in turn
+ */
+int tagmatch_scalar(const unsigned long long* tags, const unsigned long long* valid,
+                    int E, unsigned long long tag)
+{
+    for(int j=0;j<E;j++){
+        if(tags[j] == tag && ((valid[j >> 6] >> (j & 63)) & 1)){
+            return j;
+        }
+    }
+    return -1;
+}
+
+/*
+ * tagmatch_avx2 - Compare eight 64-bit tags per iteration, four per
+ *     instruction. The eight valid bits of a group never straddle a bitmap
+ *     word because groups start at multiples of 8. The ragged tail is left
+ *     to the scalar loop so we never load past the end of the set.
+ */
+__attribute__((target("avx2")))
+int tagmatch_avx2(const unsigned long long* tags, const unsigned long long* valid,
+                  int E, unsigned long long tag)
+{
+    __m256i key = _mm256_set1_epi64x(tag);
+    int j = 0;
+    for(;j+8<=E;j+=8){
+        __m256i lo = _mm256_loadu_si256((const __m256i*)(tags + j));
+        __m256i hi = _mm256_loadu_si256((const __m256i*)(tags + j + 4));
+        unsigned mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(lo, key)))
+                      | _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(hi, key))) << 4;
+        mask &= (valid[j >> 6] >> (j & 63)) & 0xff;
+        if(mask){
+            return j + __builtin_ctz(mask);
+        }
+    }
+    for(;j<E;j++){
+        if(tags[j] == tag && ((valid[j >> 6] >> (j & 63)) & 1)){
+            return j;
+        }
+    }
+    return -1;
+}
+
+int tagmatch_has_avx2(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+tagmatch_fn tagmatch_select(int E)
+{
+    if(E >= AVX2_MIN_WAYS && tagmatch_has_avx2()){
+        return tagmatch_avx2;
+    }
+    return tagmatch_scalar;
+}
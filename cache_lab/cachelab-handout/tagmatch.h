@@ -0,0 +1,27 @@
+/*
+ * tagmatch.h - Set tag lookup kernels for the cache simulator
+ */
+
+#ifndef CACHELAB_TAGMATCH_H
+#define CACHELAB_TAGMATCH_H
+
+/*
+ * A tag match kernel returns the first way in [0, E) whose tag equals
+ * `tag` and whose bit is set in the `valid` bitmap, or -1 if there is none.
+ */
+typedef int (*tagmatch_fn)(const unsigned long long* tags,
+                           const unsigned long long* valid,
+                           int E, unsigned long long tag);
+
+int tagmatch_scalar(const unsigned long long* tags, const unsigned long long* valid,
+                    int E, unsigned long long tag);
+int tagmatch_avx2(const unsigned long long* tags, const unsigned long long* valid,
+                  int E, unsigned long long tag);
+
+/* Non-zero when the running CPU can execute tagmatch_avx2 */
+int tagmatch_has_avx2(void);
+
+/* Pick the fastest kernel for the running CPU and associativity E */
+tagmatch_fn tagmatch_select(int E);
+
+#endif /* CACHELAB_TAGMATCH_H */
@@ -3,6 +3,7 @@
  *     student's transpose functions and records the results for their
  *     official submitted version as well.
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -11,7 +12,11 @@
 #include <signal.h>
 #include <getopt.h>
 #include <sys/types.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include "cachelab.h"
+#include "cachesim.h"
+#include "tracer.h"
 #include <sys/wait.h> // fir WEXITSTATUS
 #include <limits.h> // for INT_MAX
 
@@ -32,6 +37,17 @@ extern int func_counter;
 /* Globals set on the command line */
 static int M = 0;
 static int N = 0;
+static int native = 0;
+static int jobs = 1;
+static TlbConfig tlb_config;
+static PrefetchConfig prefetch_config;
+
+/* The outcome of evaluating each registered function */
+static struct {
+    int flag;
+    CacheStats st;
+} evals[MAX_TRANS_FUNCS];
+static int next_func;
 
 /* The correctness and performance for the submitted transpose function */
 struct results {
@@ -41,47 +57,154 @@ struct results {
 };
 static struct results results = {-1, 0, INT_MAX};
 
+/*
+ * trace_and_simulate - Run function i under valgrind and simulate its
+ *     trace in this process as it arrives through a pipe, keeping only
+ *     the marked region. tracegen sends the marker addresses through a
+ *     second pipe, so valgrind's log cannot break up the marker line.
+ *     Returns tracegen's exit status (non-zero when the function failed
+ *     validation), or -1 if the pipeline could not run.
+ *     On success st holds the simulator's counts.
+ */
+static int trace_and_simulate(int i, unsigned int s, unsigned int E, unsigned int b,
+                              CacheStats* st)
+{
+    char Mstr[16], Nstr[16], Fstr[16], mstr[16];
+    CacheConfig cfg = {s, E, b, LRU, false, false, false};
+    trace_reader_t reader;
+    int fds[2], mfds[2], status, ret;
+    pid_t tracer;
+
+    cfg.prefetch = prefetch_config;
+    cfg.tlb = tlb_config;
+    sprintf(Mstr, "%d", M); sprintf(Nstr, "%d", N); sprintf(Fstr, "%d", i);
+    /* Close-on-exec, so pipelines started by other threads can't hold this one open */
+    if (pipe2(fds, O_CLOEXEC) < 0)
+        return -1;
+    if (pipe2(mfds, O_CLOEXEC) < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    sprintf(mstr, "%d", mfds[1]);
+
+    if ((tracer = fork()) == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        fcntl(mfds[1], F_SETFD, 0);     /* the one pipe tracegen keeps */
+        execlp("valgrind", "valgrind", "--tool=lackey", "--trace-mem=yes",
+               "--log-fd=1", "-v", "./tracegen", "-M", Mstr, "-N", Nstr,
+               "-F", Fstr, "-m", mstr, (char*) NULL);
+        _exit(127);
+    }
+    close(fds[1]);
+    close(mfds[1]);
+    if (tracer < 0) {
+        close(fds[0]);
+        close(mfds[0]);
+        return -1;
+    }
+
+    if (trace_fdopen(&reader, fds[0]) < 0) {
+        close(mfds[0]);
+        ret = -1;
+    } else {
+        trace_markers_from(&reader, mfds[0]);
+        ret = cachesim_run(&cfg, &reader, st, NULL, NULL);
+        if (ret == 0 && !trace_markers_seen(&reader)) {
+            printf("Error: tracegen's marker line never arrived for function %d\n", i);
+            ret = -1;
+        }
+        trace_close(&reader);
+    }
+    waitpid(tracer, &status, 0);
+    if (ret < 0 || !WIFEXITED(status) || WEXITSTATUS(status) == 127)
+        return -1;
+    return WEXITSTATUS(status);
+}
+
+/*
+ * trace_native - Run function i in this process on a copy of trans.c
+ *     built with -fsanitize=thread, whose memory access hooks simulate
+ *     the accesses to A and B as they happen. mat comes from
+ *     tracer_matrices(). Returns i+1 if the function failed validation,
+ *     0 otherwise, like tracegen.
+ */
+static int trace_native(int i, unsigned int s, unsigned int E, unsigned int b,
+                        int* mat, CacheStats* st)
+{
+    CacheConfig cfg = {s, E, b, LRU, false, false, false, prefetch_config, tlb_config};
+
+    if (!tracer_simulate(&cfg, mat, M, N, func_list[i].func_ptr, st))
+        return i+1;
+    return 0;
+}
+
+struct geometry {
+    unsigned int s, E, b;
+};
+
+/*
+ * eval_worker - Evaluate registered functions until none are left. With
+ *     -j several of these run at once, each taking the next function.
+ */
+static void* eval_worker(void* arg)
+{
+    struct geometry* g = arg;
+    int i, *mat = NULL;
+
+    if (native && !(mat = tracer_matrices()))
+        return NULL;
+
+    while ((i = __atomic_fetch_add(&next_func, 1, __ATOMIC_RELAXED)) < func_counter) {
+        if (native)
+            evals[i].flag = trace_native(i, g->s, g->E, g->b, mat, &evals[i].st);
+        else /* valgrind streams the trace into the simulator, no files in between */
+            evals[i].flag = trace_and_simulate(i, g->s, g->E, g->b, &evals[i].st);
+    }
+    free(mat);
+    return NULL;
+}
+
 /* 
  * eval_perf - Evaluate the performance of the registered transpose functions
  */
 void eval_perf(unsigned int s, unsigned int E, unsigned int b)
 {
     int i,flag;
-    unsigned int len, hits, misses, evictions;
-    unsigned long long int marker_start, marker_end, addr;
-    char buf[1000], cmd[255];
-    char filename[128];
+    CacheStats st;
+    struct geometry g = {s, E, b};
+    pthread_t threads[jobs];
 
     registerFunctions(); 
 
-    /* Open the complete trace file */
-    FILE* full_trace_fp;  
-    FILE* part_trace_fp; 
-
-    /* Evaluate the performance of each registered transpose function */
+    /* Evaluate every registered transpose function, jobs at a time */
+    for (i=0; i<func_counter; i++)
+        evals[i].flag = -1;
+    for (i=1; i<jobs; i++)
+        pthread_create(&threads[i], NULL, eval_worker, &g);
+    eval_worker(&g);
+    for (i=1; i<jobs; i++)
+        pthread_join(threads[i], NULL);
 
+    /* Report them in order */
     for (i=0; i<func_counter; i++) {
         if (strcmp(func_list[i].description, SUBMIT_DESCRIPTION) == 0 )
             results.funcid = i; /* remember which function is the submission */
 
 
         printf("\nFunction %d (%d total)\nStep 1: Validating and generating memory traces\n",i,func_counter);
-        /* Use valgrind to generate the trace */
-
-        sprintf(cmd, "valgrind --tool=lackey --trace-mem=yes --log-fd=1 -v ./tracegen -M %d -N %d -F %d  > trace.tmp", M, N,i);
-        flag=WEXITSTATUS(system(cmd));
+        printf("Step 2: Evaluating performance (s=%d, E=%d, b=%d)\n", s, E, b);
+        flag = evals[i].flag;
+        st = evals[i].st;
+        if (flag < 0) {
+            printf("Error: could not run valgrind for function %d.\nSkipping performance evaluation for this function.\n", i);
+            continue;
+        }
         if (0!=flag) {
             printf("Validation error at function %d! Run ./tracegen -M %d -N %d -F %d for details.\nSkipping performance evaluation for this function.\n",flag-1,M,N,i);      
             continue;
         }
 
-        /* Get the start and end marker addresses */
-        FILE* marker_fp = fopen(".marker", "r");
-        assert(marker_fp);
-        fscanf(marker_fp, "%llx %llx", &marker_start, &marker_end);
-        fclose(marker_fp);
-
-
         func_list[i].correct=1;
 
         /* Save the correctness of the transpose submission */
@@ -89,72 +212,23 @@ void eval_perf(unsigned int s, unsigned int E, unsigned int b)
             results.correct = 1;
         }
 
-        full_trace_fp = fopen("trace.tmp", "r");
-        assert(full_trace_fp);
-
-
-        /* Filtered trace for each transpose function goes in a separate file */
-        sprintf(filename, "trace.f%d", i);
-        part_trace_fp = fopen(filename, "w");
-        assert(part_trace_fp);
-    
-        /* Locate trace corresponding to the trans function */
-        flag = 0;
-        while (fgets(buf, 1000, full_trace_fp) != NULL) {
-
-            /* We are only interested in memory access instructions */
-            if (buf[0]==' ' && buf[2]==' ' &&
-                (buf[1]=='S' || buf[1]=='M' || buf[1]=='L' )) {
-                sscanf(buf+3, "%llx,%u", &addr, &len);
-        
-                /* If start marker found, set flag */
-                if (addr == marker_start)
-                    flag = 1;
-
-                /* Valgrind creates many spurious accesses to the
-                   stack that have nothing to do with the students
-                   code. At the moment, we are ignoring all stack
-                   accesses by using the simple filter of recording
-                   accesses to only the low 32-bit portion of the
-                   address space. At some point it would be nice to
-                   try to do more informed filtering so that would
-                   eliminate the valgrind stack references while
-                   include the student stack references. */
-                if (flag && addr < 0xffffffff) {
-                    fputs(buf, part_trace_fp);
-                }
-
-                /* if end marker found, close trace file */
-                if (addr == marker_end) {
-                    flag = 0;
-                    fclose(part_trace_fp);
-                    break;
-                }
-            }
-        }
-        fclose(full_trace_fp);
-
-        /* Run the reference simulator */
-        printf("Step 2: Evaluating performance (s=%d, E=%d, b=%d)\n", s, E, b);
-        char cmd[255];
-        sprintf(cmd, "./csim-ref -s %u -E %u -b %u -t trace.f%d > /dev/null", 
-                s, E, b, i);
-        system(cmd);
-    
-        /* Collect results from the reference simulator */
-        FILE* in_fp = fopen(".csim_results","r");
-        assert(in_fp);
-        fscanf(in_fp, "%u %u %u", &hits, &misses, &evictions);
-        fclose(in_fp);
-        func_list[i].num_hits = hits;
-        func_list[i].num_misses = misses;
-        func_list[i].num_evictions = evictions;
-        printf("func %u (%s): hits:%u, misses:%u, evictions:%u\n",
-               i, func_list[i].description, hits, misses, evictions);
+        /* Collect results from the simulator */
+        func_list[i].num_hits = st.hits;
+        func_list[i].num_misses = st.misses;
+        func_list[i].num_evictions = st.evictions;
+        printf("func %u (%s): hits:%llu, misses:%llu, evictions:%llu\n",
+               i, func_list[i].description, st.hits, st.misses, st.evictions);
+        if (tlb_config.pageBits)
+            printf("func %u tlb: lookups:%llu, l1 misses:%llu, l2 misses:%llu, walks:%llu, walk refs:%llu\n",
+                   i, st.tlb.lookups, st.tlb.misses[0], st.tlb.misses[1],
+                   st.tlb.walks, st.tlb.walkRefs);
+        if (prefetch_config.kind != PF_NONE)
+            printf("func %u prefetches: issued:%llu, useful:%llu, late:%llu, polluting:%llu\n",
+                   i, st.pfIssued, st.pfUseful, st.pfLate, st.pfPolluting);
     
         /* If it is transpose_submit(), record number of misses */
         if (results.funcid == i) {
-            results.misses = misses;
+            results.misses = st.misses;
         }
     }
   
@@ -164,9 +238,13 @@ void eval_perf(unsigned int s, unsigned int E, unsigned int b)
  * usage - Print usage info
  */
 void usage(char *argv[]){
-    printf("Usage: %s [-h] -M <rows> -N <cols>\n", argv[0]);
+    printf("Usage: %s [-hn] [-j <jobs>] [-g <tlb>] [-f <prefetcher>] -M <rows> -N <cols>\n", argv[0]);
     printf("Options:\n");
     printf("  -h          Print this help message.\n");
+    printf("  -n          Trace natively in-process instead of under valgrind.\n");
+    printf("  -j <jobs>   Evaluate this many functions at once (default 1)\n");
+    printf("  -g <tlb>    Also count TLB misses, e.g. 4k:16x4:128x12 (see csim -g)\n");
+    printf("  -f <pf>     Simulate a prefetcher, e.g. stream:8 (see csim -f)\n");
     printf("  -M <rows>   Number of matrix rows (max %d)\n", MAXN);
     printf("  -N <cols>   Number of  matrix columns (max %d)\n", MAXN);
     printf("Example: %s -M 8 -N 8\n", argv[0]);       
@@ -199,7 +277,7 @@ int main(int argc, char* argv[])
 {
     char c;
 
-    while ((c = getopt(argc,argv,"M:N:h")) != -1) {
+    while ((c = getopt(argc,argv,"M:N:nj:g:f:h")) != -1) {
         switch(c) {
         case 'M':
             M = atoi(optarg);
@@ -207,6 +285,26 @@ int main(int argc, char* argv[])
         case 'N':
             N = atoi(optarg);
             break;
+        case 'n':
+            native = 1;
+            break;
+        case 'j':
+            jobs = atoi(optarg);
+            break;
+        case 'g':
+            if (tlb_parse(optarg, &tlb_config) < 0) {
+                printf("Error: bad TLB %s\n", optarg);
+                usage(argv);
+                exit(1);
+            }
+            break;
+        case 'f':
+            if (prefetch_parse(optarg, &prefetch_config) < 0) {
+                printf("Error: bad prefetcher %s\n", optarg);
+                usage(argv);
+                exit(1);
+            }
+            break;
         case 'h':
             usage(argv);
             exit(0);
@@ -222,6 +320,12 @@ int main(int argc, char* argv[])
         exit(1);
     }
 
+    if (jobs < 1) {
+        printf("Error: -j needs at least one job\n");
+        usage(argv);
+        exit(1);
+    }
+
     if (M > MAXN || N > MAXN) {
         printf("Error: M or N exceeds %d\n", MAXN);
         usage(argv);
@@ -0,0 +1,96 @@
+/*
+ * tlb.c - Lookups, fills and page walks of the TLB model
+ */
+#include "tlb.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int tlb_parse(const char* spec, TlbConfig* cfg){
+    char page[4];
+    int n = 0, m = 0;
+    memset(cfg, 0, sizeof(*cfg));
+    if(sscanf(spec, "%3[0-9kmKM]:%dx%d%n", page, &cfg->sets[0], &cfg->ways[0], &n) < 3)
+        return -1;
+    if(spec[n] == ':'){
+        if(sscanf(spec + n, ":%dx%d%n", &cfg->sets[1], &cfg->ways[1], &m) < 2 || spec[n + m])
+            return -1;
+    } else if(spec[n]){
+        return -1;
+    }
+    if(strcmp(page, "4k") == 0 || strcmp(page, "4K") == 0) cfg->pageBits = 12;
+    else if(strcmp(page, "2m") == 0 || strcmp(page, "2M") == 0) cfg->pageBits = 21;
+    else return -1;
+    if(m && cfg->ways[1] < 1) return -1;
+    return tlb_check(cfg);
+}
+
+int tlb_check(const TlbConfig* cfg){
+    if(cfg->pageBits != 12 && cfg->pageBits != 21) return -1;
+    for(int i=0;i<TLB_LEVELS;i++){
+        int sets = cfg->sets[i];
+        if(i > 0 && !cfg->ways[i] && !sets) break;
+        if(sets < 1 || (sets & (sets - 1)) || cfg->ways[i] < 1) return -1;
+    }
+    return 0;
+}
+
+Tlb* newTlb(const TlbConfig* cfg){
+    Tlb* t = calloc(1, sizeof(Tlb));
+    t->pageBits = cfg->pageBits;
+    for(int i=0;i<TLB_LEVELS && cfg->ways[i];i++){
+        TlbLevel* l = &t->level[i];
+        size_t entries = (size_t)cfg->sets[i] * cfg->ways[i];
+        l->sets = cfg->sets[i];
+        l->ways = cfg->ways[i];
+        l->vpns = calloc(entries, sizeof(unsigned long long));
+        l->stamps = calloc(entries, sizeof(unsigned long long));
+        t->nlevels++;
+    }
+    return t;
+}
+
+void freeTlb(Tlb* t){
+    if(!t) return;
+    for(int i=0;i<t->nlevels;i++){
+        free(t->level[i].vpns);
+        free(t->level[i].stamps);
+    }
+    free(t);
+}
+
+// looks vpn up in l, returning whether it hit; a miss fills it over the LRU entry
+static int lookup(Tlb* t, TlbLevel* l, unsigned long long vpn){
+    size_t base = (size_t)(vpn & (l->sets - 1)) * l->ways;
+    unsigned long long* vpns = l->vpns + base;
+    unsigned long long* stamps = l->stamps + base;
+    int victim = 0;
+    for(int w=0;w<l->ways;w++){
+        if(vpns[w] == vpn + 1){
+            stamps[w] = ++t->clock;
+            return 1;
+        }
+        if(stamps[w] < stamps[victim]) victim = w;
+    }
+    vpns[victim] = vpn + 1;
+    stamps[victim] = ++t->clock;
+    return 0;
+}
+
+static void translate(Tlb* t, unsigned long long vpn){
+    int i;
+    t->stats.lookups++;
+    for(i=0;i<t->nlevels;i++){
+        if(lookup(t, &t->level[i], vpn)) return;
+        t->stats.misses[i]++;
+    }
+    t->stats.walks++;
+    t->stats.walkRefs += t->pageBits == 21 ? 3 : 4;
+}
+
+void tlb_access(Tlb* t, unsigned long long addr, unsigned size){
+    unsigned long long first = addr >> t->pageBits;
+    unsigned long long last = (addr + (size ? size - 1 : 0)) >> t->pageBits;
+    for(unsigned long long vpn=first;vpn<=last;vpn++) translate(t, vpn);
+}
@@ -0,0 +1,64 @@
+/*
+ * tlb.h - Set-associative TLB model with an optional second level
+ *
+ * Every access is translated at the page holding each of its bytes, one
+ * page size per run: 4KB or 2MB. A lookup that misses the L1 TLB tries
+ * the L2 TLB, and one that misses the last level walks the page table,
+ * filling every level on the way back. Both levels replace LRU and
+ * neither constrains the other. A walk is counted as one memory reference
+ * per page table level, four for 4KB pages and three for 2MB pages on
+ * x86-64; the walk's references are not simulated in the data cache.
+ */
+
+#ifndef CACHELAB_TLB_H
+#define CACHELAB_TLB_H
+
+#define TLB_LEVELS 2
+
+typedef struct TlbConfig{
+    int pageBits;                   /* 12 or 21, 0 for no TLB */
+    int sets[TLB_LEVELS];
+    int ways[TLB_LEVELS];           /* 0 for a missing level */
+} TlbConfig;
+
+typedef struct TlbStats{
+    unsigned long long lookups;
+    unsigned long long misses[TLB_LEVELS];
+    unsigned long long walks;
+    unsigned long long walkRefs;
+} TlbStats;
+
+typedef struct TlbLevel{
+    int sets, ways;
+    unsigned long long* vpns;       /* page number + 1, 0 for an empty entry */
+    unsigned long long* stamps;     /* last use, for LRU */
+} TlbLevel;
+
+typedef struct Tlb{
+    int pageBits;
+    int nlevels;
+    unsigned long long clock;
+    TlbLevel level[TLB_LEVELS];
+    TlbStats stats;
+} Tlb;
+
+/*
+ * Parse "page:SETSxWAYS[:SETSxWAYS]" with page 4k or 2m, L1 first, e.g.
+ * "4k:16x4:128x12". Returns 0 on success and -1 on a bad spec.
+ */
+int tlb_parse(const char* spec, TlbConfig* cfg);
+
+/*
+ * Check a TLB with pages of 2^pageBits bytes, 12 or 21, and levels of
+ * at least one way and a power of two of sets, the L2 TLB possibly
+ * missing. Returns 0 if cfg is one and -1 otherwise.
+ */
+int tlb_check(const TlbConfig* cfg);
+
+Tlb* newTlb(const TlbConfig* cfg);
+void freeTlb(Tlb* t);
+
+/* Translate the size bytes at addr */
+void tlb_access(Tlb* t, unsigned long long addr, unsigned size);
+
+#endif /* CACHELAB_TLB_H */
@@ -0,0 +1,436 @@
+/*
+ * trace.c - Zero-copy reader for valgrind lackey memory traces
+ *
+ * Lackey writes one access per line:
+ *
+ *     I 0400d7d4,8
+ *      L 7ff0005b8,8
+ *      S 7ff0005b0,8
+ *      M 0421c7f0,4
+ *
+ * Data accesses have a space in column 0 and 2 and the operation in
+ * column 1, followed by a hex address and a decimal size. Every other
+ * line (instruction fetches, valgrind chatter) is skipped.
+ *
+ * Binary traces (see trace.h) are recognized by their magic number and
+ * decoded from the same mapping.
+ *
+ * Traces that are not regular files (stdin, pipes) are streamed through
+ * a buffer instead, so csim can consume valgrind's output as it is
+ * produced.
+ *
+ * Until a marker line has been read, a filtering reader looks for one
+ * anywhere in a line: valgrind may write part of a trace line, then the
+ * marker line, then the rest, and both broken halves are dropped.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Hex digit values, 0xff for anything that is not a hex digit */
+static unsigned char hexval[256];
+
+/* Filled in before main() so readers on several threads can share it */
+__attribute__((constructor))
+static void init_hexval(void)
+{
+    memset(hexval, 0xff, sizeof(hexval));
+    for(int c='0';c<='9';c++) hexval[c] = c - '0';
+    for(int c='a';c<='f';c++) hexval[c] = c - 'a' + 10;
+    for(int c='A';c<='F';c++) hexval[c] = c - 'A' + 10;
+}
+
+#define STREAM_CHUNK (1 << 20)
+
+/*
+ * refill - Move the unread tail of the stream buffer to its front and
+ *     read more behind it, growing the buffer if one line fills it.
+ *     Returns the number of bytes read, 0 at end of input.
+ */
+static void poll_markers(trace_reader_t* reader);
+
+static size_t refill(trace_reader_t* reader)
+{
+    size_t left = reader->end - reader->cur;
+    ssize_t n;
+
+    if(reader->eof) return 0;
+    memmove(reader->buf, reader->cur, left);
+    if(left == reader->buf_size){
+        reader->buf_size *= 2;
+        reader->buf = realloc(reader->buf, reader->buf_size);
+    }
+    do{
+        n = read(reader->fd, reader->buf + left, reader->buf_size - left);
+    } while(n < 0 && errno == EINTR);
+    if(n <= 0){
+        reader->eof = 1;
+        n = 0;
+    }
+    reader->cur = reader->buf;
+    reader->end = reader->buf + left + n;
+    poll_markers(reader);
+    return n;
+}
+
+/* Make at least want bytes readable, or as many as the stream has left */
+static void ensure(trace_reader_t* reader, size_t want)
+{
+    while(reader->fd >= 0 && (size_t)(reader->end - reader->cur) < want &&
+          refill(reader) > 0);
+}
+
+static int open_stream(trace_reader_t* reader, int fd)
+{
+    reader->fd = fd;
+    reader->buf_size = STREAM_CHUNK;
+    reader->buf = malloc(reader->buf_size);
+    if(!reader->buf) return -1;
+    reader->cur = reader->end = reader->buf;
+    ensure(reader, TRACE_BIN_HEADER_SIZE);
+    return 0;
+}
+
+/* Recognize a binary trace by its header and skip past it */
+static int detect_binary(trace_reader_t* reader)
+{
+    if(reader->end - reader->cur >= TRACE_BIN_HEADER_SIZE &&
+       memcmp(reader->cur, TRACE_BIN_MAGIC, 4) == 0){
+        const unsigned char* h = (const unsigned char*) reader->cur;
+        if((h[4] | h[5] << 8) != TRACE_BIN_VERSION){
+            trace_close(reader);
+            return -1;
+        }
+        reader->binary = 1;
+        reader->cur += TRACE_BIN_HEADER_SIZE;
+    }
+    return 0;
+}
+
+int trace_open(trace_reader_t* reader, const char* path)
+{
+    struct stat st;
+    int fd;
+
+    memset(reader, 0, sizeof(*reader));
+    reader->fd = reader->marker_fd = -1;
+    if(strcmp(path, "-") == 0){
+        if(open_stream(reader, STDIN_FILENO) < 0) return -1;
+    } else{
+        if((fd = open(path, O_RDONLY)) < 0) return -1;
+        if(fstat(fd, &st) < 0){
+            close(fd);
+            return -1;
+        }
+        if(!S_ISREG(st.st_mode)){
+            if(open_stream(reader, fd) < 0){
+                close(fd);
+                return -1;
+            }
+        } else{
+            if(st.st_size > 0){
+                reader->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if(reader->map == MAP_FAILED){
+                    close(fd);
+                    reader->map = NULL;
+                    return -1;
+                }
+                reader->map_len = st.st_size;
+                posix_madvise(reader->map, reader->map_len, POSIX_MADV_SEQUENTIAL);
+            }
+            close(fd);
+            reader->cur = reader->map;
+            reader->end = reader->cur + reader->map_len;
+        }
+    }
+    return detect_binary(reader);
+}
+
+int trace_fdopen(trace_reader_t* reader, int fd)
+{
+    memset(reader, 0, sizeof(*reader));
+    reader->fd = reader->marker_fd = -1;
+    if(open_stream(reader, fd) < 0){
+        close(fd);
+        return -1;
+    }
+    return detect_binary(reader);
+}
+
+void trace_filter_markers(trace_reader_t* reader)
+{
+    reader->filter = 1;
+    reader->in_region = 0;
+    reader->marker_start = reader->marker_end = ~0ULL;
+}
+
+void trace_markers_from(trace_reader_t* reader, int fd)
+{
+    trace_filter_markers(reader);
+    reader->marker_fd = fd;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    poll_markers(reader);
+}
+
+int trace_markers_seen(const trace_reader_t* reader)
+{
+    return reader->marker_start != ~0ULL;
+}
+
+static const char bin_ops[4] = {'L', 'S', 'M', 'L'};
+
+/* Decode a LEB128 varint, returns NULL if it runs past end */
+static const unsigned char* get_varint(const unsigned char* p,
+                                       const unsigned char* end,
+                                       unsigned long long* value)
+{
+    unsigned long long v = 0;
+    int shift = 0;
+    while(p < end && shift < 64){
+        unsigned char c = *p++;
+        v |= (unsigned long long)(c & 0x7f) << shift;
+        if(!(c & 0x80)){
+            *value = v;
+            return p;
+        }
+        shift += 7;
+    }
+    return NULL;
+}
+
+static int bin_next(trace_reader_t* reader, trace_access_t* access)
+{
+    unsigned long long size, delta;
+
+    ensure(reader, TRACE_BIN_MAX_RECORD);
+    const unsigned char* p = (const unsigned char*) reader->cur;
+    const unsigned char* end = (const unsigned char*) reader->end;
+    if(p >= end) return 0;
+    unsigned char head = *p++;
+    size = head >> 2;
+    if(size == 63 && !(p = get_varint(p, end, &size))) goto truncated;
+    if(!(p = get_varint(p, end, &delta))) goto truncated;
+
+    reader->prev += (delta >> 1) ^ -(delta & 1);
+    access->op = bin_ops[head & 3];
+    access->addr = reader->prev;
+    access->size = size;
+    reader->cur = (const char*) p;
+    return 1;
+
+truncated:
+    reader->cur = reader->end;
+    return 0;
+}
+
+/* Parse a hex number at *p, stopping at stop or the first non-digit */
+static unsigned long long get_hex(const unsigned char** p, const unsigned char* stop)
+{
+    unsigned long long v = 0;
+    const unsigned char* q = *p;
+    while(q < stop && hexval[*q] != 0xff) v = v << 4 | hexval[*q++];
+    *p = q;
+    return v;
+}
+
+/* Set [*line, *stop) to the next line. Returns 0 at end of input. */
+static int next_line(trace_reader_t* reader, const char** line, const char** stop)
+{
+    for(;;){
+        const char* nl = memchr(reader->cur, '\n', reader->end - reader->cur);
+        if(nl || reader->fd < 0 || reader->eof){
+            if(reader->cur == reader->end) return 0;
+            *line = reader->cur;
+            *stop = nl ? nl + 1 : reader->end;
+            reader->cur = *stop;
+            return 1;
+        }
+        refill(reader);
+    }
+}
+
+static void parse_markers(trace_reader_t* reader, const char* line, const char* stop)
+{
+    const unsigned char* q = (const unsigned char*) line + strlen(TRACE_MARKER_PREFIX);
+    const unsigned char* end = (const unsigned char*) stop;
+    reader->marker_start = get_hex(&q, end);
+    while(q < end && *q == ' ') q++;
+    reader->marker_end = get_hex(&q, end);
+    reader->in_region = 0;
+}
+
+/* The marker line starting anywhere in [line, stop), or NULL */
+static const char* find_markers(const char* line, const char* stop)
+{
+    size_t len = strlen(TRACE_MARKER_PREFIX);
+    for(const char* p=line;stop-p>(long)len;p++){
+        p = memchr(p, TRACE_MARKER_PREFIX[0], stop - p - len);
+        if(!p) break;
+        if(memcmp(p, TRACE_MARKER_PREFIX, len) == 0) return p;
+    }
+    return NULL;
+}
+
+/* Read whatever has arrived of the marker line on marker_fd, without blocking */
+static void poll_markers(trace_reader_t* reader)
+{
+    size_t room = sizeof(reader->marker_line) - 1 - reader->marker_len;
+    ssize_t n;
+
+    if(reader->marker_fd < 0 || trace_markers_seen(reader) || room == 0) return;
+    n = read(reader->marker_fd, reader->marker_line + reader->marker_len, room);
+    if(n <= 0) return;
+    reader->marker_len += n;
+    char* nl = memchr(reader->marker_line, '\n', reader->marker_len);
+    const char* line = find_markers(reader->marker_line, reader->marker_line + reader->marker_len);
+    if(nl && line) parse_markers(reader, line, nl);
+}
+
+static int text_next(trace_reader_t* reader, trace_access_t* access)
+{
+    const char* line;
+    const char* stop;
+
+    while(next_line(reader, &line, &stop)){
+        const char* markers;
+        if(reader->filter && reader->marker_fd < 0 && !trace_markers_seen(reader) &&
+           (markers = find_markers(line, stop))){
+            parse_markers(reader, markers, stop);
+            continue;
+        }
+        if(stop - line < 4 || line[0] != ' ' || line[2] != ' '){
+            if(reader->filter && stop - line > (long) strlen(TRACE_MARKER_PREFIX) &&
+               memcmp(line, TRACE_MARKER_PREFIX, strlen(TRACE_MARKER_PREFIX)) == 0){
+                parse_markers(reader, line, stop);
+            }
+            continue;
+        }
+        if(line[1] != 'L' && line[1] != 'S' && line[1] != 'M') continue;
+
+        const unsigned char* q = (const unsigned char*) line + 3;
+        const unsigned char* end = (const unsigned char*) stop;
+        unsigned int size = 0;
+        access->addr = get_hex(&q, end);
+        if(q < end && *q == ',') q++;
+        while(q < end && *q >= '0' && *q <= '9') size = size * 10 + (*q++ - '0');
+        access->op = line[1];
+        access->size = size;
+        return 1;
+    }
+    return 0;
+}
+
+int trace_next(trace_reader_t* reader, trace_access_t* access)
+{
+    while(reader->binary ? bin_next(reader, access) : text_next(reader, access)){
+        if(!reader->filter) return 1;
+        if(access->addr == reader->marker_start) reader->in_region = 1;
+        int keep = reader->in_region && access->addr < 0xffffffff;
+        if(access->addr == reader->marker_end) reader->in_region = 0;
+        if(keep) return 1;
+    }
+    return 0;
+}
+
+/* Step over one binary record, keeping reader->prev up to date */
+static int bin_skip(trace_reader_t* reader)
+{
+    unsigned long long size, delta;
+
+    ensure(reader, TRACE_BIN_MAX_RECORD);
+    const unsigned char* p = (const unsigned char*) reader->cur;
+    const unsigned char* end = (const unsigned char*) reader->end;
+    if(p >= end) return 0;
+    if((*p++ >> 2) == 63 && !(p = get_varint(p, end, &size))) goto truncated;
+    if(!(p = get_varint(p, end, &delta))) goto truncated;
+    reader->prev += (delta >> 1) ^ -(delta & 1);
+    reader->cur = (const char*) p;
+    return 1;
+
+truncated:
+    reader->cur = reader->end;
+    return 0;
+}
+
+/* Step over one text data access by its first three columns, without parsing it */
+static int text_skip(trace_reader_t* reader)
+{
+    const char* line;
+    const char* stop;
+
+    while(next_line(reader, &line, &stop)){
+        if(stop - line >= 4 && line[0] == ' ' && line[2] == ' ' &&
+           (line[1] == 'L' || line[1] == 'S' || line[1] == 'M'))
+            return 1;
+    }
+    return 0;
+}
+
+unsigned long long trace_skip(trace_reader_t* reader, unsigned long long n)
+{
+    trace_access_t access;
+    unsigned long long k = 0;
+
+    if(reader->filter){
+        while(k < n && trace_next(reader, &access)) k++;
+    } else if(reader->binary){
+        while(k < n && bin_skip(reader)) k++;
+    } else{
+        while(k < n && text_skip(reader)) k++;
+    }
+    return k;
+}
+
+void trace_close(trace_reader_t* reader)
+{
+    if(reader->map) munmap(reader->map, reader->map_len);
+    if(reader->fd > STDIN_FILENO) close(reader->fd);
+    if(reader->marker_fd >= 0) close(reader->marker_fd);
+    free(reader->buf);
+    memset(reader, 0, sizeof(*reader));
+}
+
+void trace_bin_header(unsigned char buf[TRACE_BIN_HEADER_SIZE],
+                      unsigned long long records)
+{
+    memcpy(buf, TRACE_BIN_MAGIC, 4);
+    buf[4] = TRACE_BIN_VERSION & 0xff;
+    buf[5] = TRACE_BIN_VERSION >> 8;
+    buf[6] = buf[7] = 0;
+    for(int i=0;i<8;i++) buf[8 + i] = records >> (8 * i);
+}
+
+static unsigned char* put_varint(unsigned char* p, unsigned long long v)
+{
+    while(v >= 0x80){
+        *p++ = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    *p++ = v;
+    return p;
+}
+
+size_t trace_bin_encode(unsigned char* buf, unsigned long long* prev,
+                        const trace_access_t* access)
+{
+    unsigned char* p = buf;
+    long long delta = (long long)(access->addr - *prev);
+    int op = access->op == 'S' ? 1 : access->op == 'M' ? 2 : 0;
+
+    if(access->size < 63){
+        *p++ = op | access->size << 2;
+    } else{
+        *p++ = op | 63 << 2;
+        p = put_varint(p, access->size);
+    }
+    p = put_varint(p, ((unsigned long long) delta << 1) ^ (unsigned long long)(delta >> 63));
+    *prev = access->addr;
+    return p - buf;
+}
@@ -0,0 +1,124 @@
+/*
+ * trace.h - Zero-copy reader for valgrind lackey memory traces
+ *
+ * Besides lackey text, the reader accepts a packed binary format written
+ * by trace2bin. A binary trace starts with a 16 byte header:
+ *
+ *     bytes 0-3   magic "CLTB"
+ *     bytes 4-5   format version (little endian), currently 1
+ *     bytes 6-7   reserved, zero
+ *     bytes 8-15  number of records (little endian)
+ *
+ * followed by one record per access:
+ *
+ *     1 byte      op in bits 0-1 (0 = L, 1 = S, 2 = M), size in bits 2-7;
+ *                 a size field of 63 means a varint size follows
+ *     varint      zigzag encoded delta from the previous address
+ *
+ * Varints are LEB128: 7 bits per byte, low group first, high bit set on
+ * every byte but the last.
+ */
+
+#ifndef CACHELAB_TRACE_H
+#define CACHELAB_TRACE_H
+
+#include <stddef.h>
+
+/* One data access from the trace. Instruction fetches are skipped. */
+typedef struct trace_access{
+    char op;                    /* 'L', 'S' or 'M' */
+    unsigned int size;          /* access size in bytes */
+    unsigned long long addr;
+} trace_access_t;
+
+#define TRACE_BIN_MAGIC       "CLTB"
+#define TRACE_BIN_VERSION     1
+#define TRACE_BIN_HEADER_SIZE 16
+#define TRACE_BIN_MAX_RECORD  16  /* op byte + size varint + delta varint */
+
+/*
+ * Marker line, giving the addresses of tracegen's MARKER_START and
+ * MARKER_END. test-trans has tracegen write it to a pipe of its own;
+ * otherwise tracegen prints it on stdout, in-band with valgrind's log,
+ * which may splice it into the middle of a trace line.
+ */
+#define TRACE_MARKER_PREFIX "MARKERS "
+
+/*
+ * A regular trace file is mapped read-only and parsed in place. Pipes and
+ * stdin are read in chunks into a buffer that is parsed the same way.
+ */
+typedef struct trace_reader{
+    const char* cur;
+    const char* end;
+    void* map;
+    size_t map_len;
+    int binary;                 /* non-zero for the packed format */
+    unsigned long long prev;    /* last address, for binary deltas */
+
+    int fd;                     /* stream being read, -1 when mapped */
+    int eof;
+    char* buf;                  /* stream buffer */
+    size_t buf_size;
+
+    int filter;                 /* only return the marked region */
+    int in_region;
+    unsigned long long marker_start, marker_end;    /* ~0 until a marker line is read */
+    int marker_fd;              /* pipe the marker line comes through, -1 for in-band */
+    char marker_line[64];
+    size_t marker_len;
+} trace_reader_t;
+
+/*
+ * Open the trace at path, or stdin if path is "-". Returns 0 on success
+ * and -1 on error.
+ */
+int trace_open(trace_reader_t* reader, const char* path);
+
+/* Stream the trace from fd, e.g. a pipe, which trace_close() closes */
+int trace_fdopen(trace_reader_t* reader, int fd);
+
+/*
+ * Only return accesses between the MARKER_START and MARKER_END accesses
+ * announced by an in-band marker line, and among those only the ones in
+ * the low 32-bit half of the address space. That drops the stack traffic
+ * valgrind adds, the same filter test-trans has always applied.
+ */
+void trace_filter_markers(trace_reader_t* reader);
+
+/*
+ * Filter like trace_filter_markers(), but take the marker line from fd,
+ * which the reader closes, rather than from the trace. fd is polled without blocking every time the stream buffer
+ * is refilled, so a line written before the MARKER_START access is read
+ * before that access is parsed.
+ */
+void trace_markers_from(trace_reader_t* reader, int fd);
+
+/* Whether a marker line has been read, so a filtered trace can be told from an empty one */
+int trace_markers_seen(const trace_reader_t* reader);
+
+/* Fetch the next data access. Returns 1 on success and 0 at end of trace. */
+int trace_next(trace_reader_t* reader, trace_access_t* access);
+
+/*
+ * Skip the next n data accesses without decoding them, as far as the
+ * marker filter allows. Returns the number skipped, less than n only at
+ * end of trace.
+ */
+unsigned long long trace_skip(trace_reader_t* reader, unsigned long long n);
+
+void trace_close(trace_reader_t* reader);
+
+/* Fill buf with a binary trace header for `records` accesses */
+void trace_bin_header(unsigned char buf[TRACE_BIN_HEADER_SIZE],
+                      unsigned long long records);
+
+/*
+ * Encode one access as a binary record into buf, which must have room
+ * for TRACE_BIN_MAX_RECORD bytes. *prev holds the previous address and
+ * is updated. Returns the number of bytes written.
+ */
+size_t trace_bin_encode(unsigned char* buf, unsigned long long* prev,
+                        const trace_access_t* access);
+
+#endif /* CACHELAB_TRACE_H */
@@ -0,0 +1,64 @@
+/*
+ * trace2bin.c - Convert a valgrind lackey trace to the packed binary
+ *     trace format described in trace.h. csim reads either format.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include "trace.h"
+
+#define OUTBUF (1 << 16)
+
+int main(int argc, char* argv[])
+{
+    trace_reader_t reader;
+    trace_access_t access;
+    unsigned char header[TRACE_BIN_HEADER_SIZE];
+    unsigned char buf[OUTBUF + TRACE_BIN_MAX_RECORD];
+    unsigned long long prev = 0, records = 0, bytes = TRACE_BIN_HEADER_SIZE;
+    size_t used = 0;
+
+    if(argc != 3){
+        printf("Usage: %s <lackey trace> <binary trace>\n", argv[0]);
+        return 1;
+    }
+    if(trace_open(&reader, argv[1]) < 0){
+        printf("Open Trace File Failed.\n");
+        return 1;
+    }
+    if(reader.binary){
+        printf("%s is already a binary trace.\n", argv[1]);
+        return 1;
+    }
+    FILE* out = fopen(argv[2], "wb");
+    if(!out){
+        printf("Open Output File Failed.\n");
+        return 1;
+    }
+
+    /* The record count is patched in once the trace has been read */
+    trace_bin_header(header, 0);
+    fwrite(header, 1, sizeof(header), out);
+    while(trace_next(&reader, &access)){
+        used += trace_bin_encode(buf + used, &prev, &access);
+        records++;
+        if(used >= OUTBUF){
+            fwrite(buf, 1, used, out);
+            bytes += used;
+            used = 0;
+        }
+    }
+    fwrite(buf, 1, used, out);
+    bytes += used;
+    trace_bin_header(header, records);
+    fseek(out, 0, SEEK_SET);
+    fwrite(header, 1, sizeof(header), out);
+    if(fclose(out) != 0){
+        printf("Write Output File Failed.\n");
+        return 1;
+    }
+    trace_close(&reader);
+
+    printf("%llu accesses, %llu bytes\n", records, bytes);
+    return 0;
+}
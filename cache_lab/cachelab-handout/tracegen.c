@@ -3,17 +3,22 @@
  * a memory trace of all of the registered transpose functions. 
  * 
  * The beginning and end of each registered transpose function's trace
- * is indicated by reading from "marker" addresses. These two marker
- * addresses are recorded in file for later use.
+ * is indicated by reading from "marker" addresses. With -m fd, the two
+ * marker addresses are written to fd, a pipe test-trans reads apart from
+ * the trace. Without it they are printed in-band on stdout, where
+ * valgrind interleaves them with the trace, for csim -m.
  */
 
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
 #include <assert.h>
 #include <unistd.h>
 #include <getopt.h>
 #include "cachelab.h"
+#include "trace.h"
 #include <string.h>
+#include <sys/mman.h>
 
 /* External variables declared in cachelab.c */
 extern trans_func_t func_list[MAX_TRANS_FUNCS];
@@ -25,24 +30,41 @@ extern void registerFunctions();
 /* Markers used to bound trace regions of interest */
 volatile char MARKER_START, MARKER_END;
 
-static int A[256][256];
-static int B[256][256];
+/* Matrices up to MAXN x MAXN live in the static arrays, as test-trans
+   expects; bigger ones are mapped in the low 2GB so the simulator's
+   filter on addresses below 4GB still keeps them */
+#define MAXN 256
+static int A_static[MAXN*MAXN];
+static int B_static[MAXN*MAXN];
+static int* A = A_static;
+static int* B = B_static;
 static int M;
 static int N;
 
+static int* alloc_matrix(size_t elems)
+{
+    void* p = mmap(NULL, elems * sizeof(int), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+    if (p == MAP_FAILED)
+        p = malloc(elems * sizeof(int));
+    return p;
+}
 
 int validate(int fn,int M, int N, int A[N][M], int B[M][N]) {
-    int C[M][N];
-    memset(C,0,sizeof(C));
+    int (*C)[N] = malloc(sizeof(int) * M * N);
+    assert(C);
+    memset(C,0,sizeof(int) * M * N);
     correctTrans(M,N,A,C);
     for(int i=0;i<M;i++) {
         for(int j=0;j<N;j++) {
             if(B[i][j]!=C[i][j]) {
                 printf("Validation failed on function %d! Expected %d but got %d at B[%d][%d]\n",fn,C[i][j],B[i][j],i,j);
+                free(C);
                 return 0;
             }
         }
     }
+    free(C);
     return 1;
 }
 
@@ -51,7 +73,8 @@ int main(int argc, char* argv[]){
 
     char c;
     int selectedFunc=-1;
-    while( (c=getopt(argc,argv,"M:N:F:")) != -1){
+    int markerFd=-1;
+    while( (c=getopt(argc,argv,"M:N:F:m:")) != -1){
         switch(c){
         case 'M':
             M = atoi(optarg);
@@ -62,6 +85,9 @@ int main(int argc, char* argv[]){
         case 'F':
             selectedFunc = atoi(optarg);
             break;
+        case 'm':
+            markerFd = atoi(optarg);
+            break;
         case '?':
         default:
             printf("./tracegen failed to parse its options.\n");
@@ -70,34 +96,52 @@ int main(int argc, char* argv[]){
     }
   
 
+    if (M < 1 || N < 1) {
+        printf("./tracegen needs -M and -N.\n");
+        exit(1);
+    }
+    if (M > MAXN || N > MAXN) {
+        A = alloc_matrix((size_t) M * N);
+        B = alloc_matrix((size_t) M * N);
+        if (!A || !B) {
+            printf("./tracegen could not allocate %d x %d matrices.\n", M, N);
+            exit(1);
+        }
+    }
+
     /*  Register transpose functions */
     registerFunctions();
 
     /* Fill A with data */
-    initMatrix(M,N, A, B); 
-
-    /* Record marker addresses */
-    FILE* marker_fp = fopen(".marker","w");
-    assert(marker_fp);
-    fprintf(marker_fp, "%llx %llx", 
-            (unsigned long long int) &MARKER_START,
-            (unsigned long long int) &MARKER_END );
-    fclose(marker_fp);
+    initMatrix(M,N, (int (*)[M]) A, (int (*)[N]) B); 
+
+    /* Announce marker addresses ahead of the accesses they bound */
+    if (markerFd >= 0) {
+        dprintf(markerFd, TRACE_MARKER_PREFIX "%llx %llx\n",
+                (unsigned long long int) &MARKER_START,
+                (unsigned long long int) &MARKER_END );
+        close(markerFd);
+    } else {
+        printf(TRACE_MARKER_PREFIX "%llx %llx\n",
+               (unsigned long long int) &MARKER_START,
+               (unsigned long long int) &MARKER_END );
+        fflush(stdout);
+    }
 
     if (-1==selectedFunc) {
         /* Invoke registered transpose functions */
         for (i=0; i < func_counter; i++) {
             MARKER_START = 33;
-            (*func_list[i].func_ptr)(M, N, A, B);
+            (*func_list[i].func_ptr)(M, N, (int (*)[M]) A, (int (*)[N]) B);
             MARKER_END = 34;
-            if (!validate(i,M,N,A,B))
+            if (!validate(i,M,N,(int (*)[M]) A,(int (*)[N]) B))
                 return i+1;
         }
     } else {
         MARKER_START = 33;
-        (*func_list[selectedFunc].func_ptr)(M, N, A, B);
+        (*func_list[selectedFunc].func_ptr)(M, N, (int (*)[M]) A, (int (*)[N]) B);
         MARKER_END = 34;
-        if (!validate(selectedFunc,M,N,A,B))
+        if (!validate(selectedFunc,M,N,(int (*)[M]) A,(int (*)[N]) B))
             return selectedFunc+1;
 
     }
@@ -0,0 +1,139 @@
+/*
+ * tracer.c - ThreadSanitizer hooks that drive the cache model directly
+ *
+ * A load is simulated like an L line in a valgrind trace and a store like
+ * an S line; a read-modify-write arrives as a read hook followed by a
+ * write hook, which is what csim does for an M line. As in csim, an access
+ * is simulated at the block holding its first byte.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+#include "cachelab.h"
+#include "tracer.h"
+
+/* Each thread traces on its own, into its own cache */
+static __thread struct {
+    unsigned long long lo, hi;
+} ranges[TRACER_MAX_RANGES];
+static __thread int nranges;
+
+static __thread Cache* cache;
+static __thread Shard* shard;
+static __thread Tlb* tlb;
+
+int tracer_watch(const void* base, size_t len)
+{
+    if(nranges == TRACER_MAX_RANGES) return -1;
+    ranges[nranges].lo = (unsigned long long) base;
+    ranges[nranges].hi = (unsigned long long) base + len;
+    nranges++;
+    return 0;
+}
+
+void tracer_unwatch(void)
+{
+    nranges = 0;
+}
+
+void tracer_start(Cache* c, Shard* sh)
+{
+    shard = sh;
+    cache = c;
+}
+
+void tracer_stop(void)
+{
+    cache = NULL;
+    tlb = NULL;
+}
+
+void tracer_tlb(Tlb* t)
+{
+    tlb = t;
+}
+
+int* tracer_matrices(void)
+{
+    void* mat;
+    if(posix_memalign(&mat, 4096, 2 * TRACER_MAXN*TRACER_MAXN * sizeof(int)) != 0) return NULL;
+    return mat;
+}
+
+int tracer_simulate(const CacheConfig* cfg, int* mat, int M, int N,
+                    void (*fn)(int M, int N, int A[N][M], int B[M][N]),
+                    CacheStats* st)
+{
+    int (*A)[M] = (int (*)[M]) mat;
+    int (*B)[N] = (int (*)[N]) (mat + TRACER_MAXN*TRACER_MAXN);
+    Cache* c = newCache(cfg->s, cfg->E, cfg->b, cfg->policy, cfg->data);
+    Tlb* t = cfg->tlb.pageBits ? newTlb(&cfg->tlb) : NULL;
+    Shard sh = {0};
+
+    c->writeThrough = cfg->writeThrough;
+    c->noWriteAllocate = cfg->noWriteAllocate;
+    if(cfg->prefetch.kind != PF_NONE) prefetch_attach(c, &cfg->prefetch);
+    initMatrix(M, N, A, B);
+    tracer_unwatch();
+    tracer_watch(mat, 2 * TRACER_MAXN*TRACER_MAXN * sizeof(int));
+    tracer_start(c, &sh);
+    tracer_tlb(t);
+    fn(M, N, A, B);
+    tracer_stop();
+    tracer_unwatch();
+    freeCache(c);
+    memset(st, 0, sizeof(*st));
+    cachesim_add(st, &sh);
+    if(t) st->tlb = t->stats;
+    freeTlb(t);
+
+    for(int i=0;i<N;i++){
+        for(int j=0;j<M;j++){
+            if(A[i][j] != B[j][i]) return 0;
+        }
+    }
+    return 1;
+}
+
+static inline int watched(unsigned long long addr)
+{
+    for(int i=0;i<nranges;i++){
+        if(addr >= ranges[i].lo && addr < ranges[i].hi) return 1;
+    }
+    return 0;
+}
+
+static inline void trace_access(const void* p, unsigned size, int write)
+{
+    Cache* c = cache;
+    unsigned long long addr = (unsigned long long) p, tag;
+
+    if(!c || !watched(addr)) return;
+    if(tlb) tlb_access(tlb, addr, size);
+    int set = split(c, addr, &tag);
+    if(write) store(c, shard, set, tag, size, c->policy);
+    else load(c, shard, set, tag, c->policy);
+}
+
+/*
+ * The compiler emits calls to these for instrumented code; their names
+ * and signatures are fixed by -fsanitize=thread.
+ */
+void __tsan_init(void) {}
+void __tsan_func_entry(void* pc) {}
+void __tsan_func_exit(void) {}
+
+#define TSAN_HOOKS(n) \
+    void __tsan_read##n(void* p) { trace_access(p, n, 0); } \
+    void __tsan_write##n(void* p) { trace_access(p, n, 1); } \
+    void __tsan_unaligned_read##n(void* p) { trace_access(p, n, 0); } \
+    void __tsan_unaligned_write##n(void* p) { trace_access(p, n, 1); }
+
+TSAN_HOOKS(1)
+TSAN_HOOKS(2)
+TSAN_HOOKS(4)
+TSAN_HOOKS(8)
+TSAN_HOOKS(16)
+
+void __tsan_read_range(void* p, unsigned long size) { trace_access(p, size, 0); }
+void __tsan_write_range(void* p, unsigned long size) { trace_access(p, size, 1); }
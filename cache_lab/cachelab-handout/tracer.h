@@ -0,0 +1,54 @@
+/*
+ * tracer.h - In-process memory tracer for the transpose functions
+ *
+ * test-trans links against a copy of trans.c built with -fsanitize=thread,
+ * which makes the compiler call __tsan_readN/__tsan_writeN before every
+ * load and store. tracer.c defines those hooks itself, in place of the
+ * ThreadSanitizer runtime, and feeds the accesses that fall in a watched
+ * range straight into a cache model.
+ */
+
+#ifndef CACHELAB_TRACER_H
+#define CACHELAB_TRACER_H
+
+#include <stddef.h>
+#include "cachesim.h"
+
+#define TRACER_MAX_RANGES 4
+
+/* Largest M or N tracer_matrices() holds, as in tracegen */
+#define TRACER_MAXN 256
+
+/*
+ * Ranges and the cache being traced into are per thread. Only accesses
+ * to [base, base+len) are simulated; returns -1 when full.
+ */
+int tracer_watch(const void* base, size_t len);
+
+/* Forget every watched range */
+void tracer_unwatch(void);
+
+/* Simulate accesses in c, counting into sh, until tracer_stop() */
+void tracer_start(Cache* c, Shard* sh);
+void tracer_stop(void);
+
+/* Also translate the accesses in t until tracer_stop() */
+void tracer_tlb(Tlb* t);
+
+/*
+ * Allocate A and B for tracer_simulate(), laid out like tracegen's: B
+ * starts 256KB after A and both are page aligned. Returns NULL when out
+ * of memory; free() the result.
+ */
+int* tracer_matrices(void);
+
+/*
+ * Fill mat's A with initMatrix() and run fn on it while a cache built
+ * from cfg simulates every access fn makes to the matrices. On return st
+ * holds the counts. Returns 1 if B is then the transpose of A, else 0.
+ */
+int tracer_simulate(const CacheConfig* cfg, int* mat, int M, int N,
+                    void (*fn)(int M, int N, int A[N][M], int B[M][N]),
+                    CacheStats* st);
+
+#endif /* CACHELAB_TRACER_H */
@@ -0,0 +1,18 @@
+/*
+ * trans-plans.h - Tilings found by tune-trans, one per cache and shape
+ *
+ * Each is the best of every rows x cols tile from 1x1 to 32x32 and
+ * every diagonal treatment. Regenerated by ./tune-trans -w; the {0}
+ * entry ends the table.
+ */
+static const TransPlan trans_plans[] = {
+    {5, 1, 5, 32, 32, 8, 8, DIAG_BUFFER}, /* 284 misses */
+    {5, 1, 5, 48, 48, 32, 8, DIAG_BUFFER}, /* 672 misses */
+    {5, 1, 5, 64, 64, 8, 4, DIAG_BUFFER}, /* 1648 misses */
+    {5, 1, 5, 61, 67, 32, 21, DIAG_BUFFER}, /* 1771 misses */
+    {5, 1, 5, 96, 96, 8, 8, DIAG_BUFFER}, /* 2868 misses */
+    {5, 1, 5, 100, 50, 26, 4, DIAG_BUFFER}, /* 2069 misses */
+    {5, 1, 5, 128, 128, 8, 2, DIAG_BUFFER}, /* 10688 misses */
+    {5, 1, 5, 256, 256, 8, 8, DIAG_BUFFER}, /* 73728 misses */
+    {0},
+};
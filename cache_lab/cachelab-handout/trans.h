@@ -0,0 +1,60 @@
+/*
+ * trans.h - The general tiled transpose engine in trans.c
+ */
+
+#ifndef CACHELAB_TRANS_H
+#define CACHELAB_TRANS_H
+
+#define TRANS_MAX_TILE 32
+
+/*
+ * How a tile that straddles the diagonal is copied. There A's row k and
+ * B's row k are read and written together, and in a small cache they
+ * map to the same set.
+ */
+typedef enum TransDiag{
+    DIAG_PLAIN,     /* element by element, like every other tile */
+    DIAG_DEFER,     /* each row's diagonal element is written last */
+    DIAG_BUFFER,    /* each tile row of A is read into temporaries, then written */
+    NDIAGS,
+} TransDiag;
+
+extern const char* transDiagNames[NDIAGS];
+
+/*
+ * A tiling of an M x N transpose for the cache (s, E, b): A is walked in
+ * tiles of rows x cols elements.
+ */
+typedef struct TransPlan{
+    int s, E, b;
+    int M, N;
+    int rows, cols;
+    TransDiag diag;
+} TransPlan;
+
+/*
+ * The plan tune-trans remembered for this cache and shape in
+ * trans-plans.h, or a default derived from the cache geometry
+ */
+TransPlan transpose_plan(int s, int E, int b, int M, int N);
+
+/* Transpose using plan's tiling */
+void transpose_tiled(const TransPlan* plan, int M, int N, int A[N][M], int B[M][N]);
+
+/* Transpose with the plan for the cache (s, E, b) */
+void transpose_geometry(int s, int E, int b, int M, int N, int A[N][M], int B[M][N]);
+
+#define TRANS_MAX_THREADS 64
+
+/* Threads transpose_parallel() and transpose_first_touch() use, default 1 */
+void transpose_set_threads(int n);
+
+/*
+ * Zero A and B from the threads that transpose_parallel() will use, so
+ * first-touch places each thread's pages on its own NUMA node
+ */
+void transpose_first_touch(int M, int N, int A[N][M], int B[M][N]);
+
+void transpose_parallel(int M, int N, int A[N][M], int B[M][N]);
+
+#endif /* CACHELAB_TRANS_H */
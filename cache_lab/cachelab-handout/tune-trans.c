@@ -0,0 +1,216 @@
+/*
+ * tune-trans.c - Searches tilings of the transpose engine in trans.c
+ *     against the cache simulator and remembers the best one per cache
+ *     and shape in trans-plans.h.
+ *
+ * The search covers every tile of 1 to TRANS_MAX_TILE (32) rows by 1 to
+ * 32 columns that fits the matrix, with each diagonal treatment. Every
+ * candidate runs in-process on the instrumented trans.c, the same way
+ * test-trans -n measures the registered functions.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include "cachelab.h"
+#include "cachesim.h"
+#include "tracer.h"
+#include "trans.h"
+
+#define PLANS_FILE "trans-plans.h"
+#define MAX_PLANS 256
+
+static const char* diagEnums[NDIAGS] = {"DIAG_PLAIN", "DIAG_DEFER", "DIAG_BUFFER"};
+
+static int M, N;
+static int s = 5, E = 1, b = 5;
+static int write_plan = 0;
+static int* mat;
+
+/* The plan run_plan() transposes with */
+static const TransPlan* cur_plan;
+
+static void run_plan(int M, int N, int A[N][M], int B[M][N])
+{
+    transpose_tiled(cur_plan, M, N, A, B);
+}
+
+/*
+ * simulate_plan - Transpose with plan under the simulator. Returns the
+ *     number of misses, or -1 if the result is not the transpose.
+ */
+static long long simulate_plan(const TransPlan* plan)
+{
+    CacheConfig cfg = {s, E, b, LRU, false, false, false};
+    CacheStats st;
+
+    cur_plan = plan;
+    if (!tracer_simulate(&cfg, mat, M, N, run_plan, &st))
+        return -1;
+    return st.misses;
+}
+
+/*
+ * load_plans - Read the entries of trans-plans.h into plans and their
+ *     miss counts into misses. Returns the number read.
+ */
+static int load_plans(TransPlan* plans, long long* misses)
+{
+    FILE* fp = fopen(PLANS_FILE, "r");
+    char line[256], diag[32];
+    int n = 0;
+
+    if (!fp)
+        return 0;
+    while (n < MAX_PLANS && fgets(line, sizeof(line), fp)) {
+        TransPlan* p = &plans[n];
+        misses[n] = -1;
+        if (sscanf(line, " {%d, %d, %d, %d, %d, %d, %d, %31[A-Z_]}, /* %lld",
+                   &p->s, &p->E, &p->b, &p->M, &p->N, &p->rows, &p->cols,
+                   diag, &misses[n]) < 8)
+            continue;
+        for (p->diag = 0; p->diag < NDIAGS; p->diag++)
+            if (strcmp(diag, diagEnums[p->diag]) == 0)
+                break;
+        if (p->diag < NDIAGS)
+            n++;
+    }
+    fclose(fp);
+    return n;
+}
+
+/* save_plans - Rewrite trans-plans.h with n plans */
+static int save_plans(const TransPlan* plans, const long long* misses, int n)
+{
+    FILE* fp = fopen(PLANS_FILE, "w");
+
+    if (!fp)
+        return -1;
+    fprintf(fp, "/*\n"
+                " * trans-plans.h - Tilings found by tune-trans, one per cache and shape\n"
+                " *\n"
+                " * Each is the best of every rows x cols tile from 1x1 to %dx%d and\n"
+                " * every diagonal treatment. Regenerated by ./tune-trans -w; the {0}\n"
+                " * entry ends the table.\n"
+                " */\n"
+                "static const TransPlan trans_plans[] = {\n", TRANS_MAX_TILE, TRANS_MAX_TILE);
+    for (int i=0; i<n; i++) {
+        const TransPlan* p = &plans[i];
+        fprintf(fp, "    {%d, %d, %d, %d, %d, %d, %d, %s}, /* %lld misses */\n",
+                p->s, p->E, p->b, p->M, p->N, p->rows, p->cols,
+                diagEnums[p->diag], misses[i]);
+    }
+    fprintf(fp, "    {0},\n};\n");
+    return fclose(fp);
+}
+
+/* remember - Put best into trans-plans.h, replacing any plan for its shape */
+static int remember(const TransPlan* best, long long best_misses)
+{
+    TransPlan plans[MAX_PLANS];
+    long long misses[MAX_PLANS];
+    int n = load_plans(plans, misses), i;
+
+    for (i=0; i<n; i++) {
+        const TransPlan* p = &plans[i];
+        if (p->s == s && p->E == E && p->b == b && p->M == M && p->N == N)
+            break;
+    }
+    if (i == MAX_PLANS) {
+        printf("Error: %s is full\n", PLANS_FILE);
+        return -1;
+    }
+    plans[i] = *best;
+    misses[i] = best_misses;
+    return save_plans(plans, misses, i == n ? n + 1 : n);
+}
+
+/*
+ * usage - Print usage info
+ */
+static void usage(char* argv[])
+{
+    printf("Usage: %s [-hw] [-s <s>] [-E <E>] [-b <b>] -M <rows> -N <cols>\n", argv[0]);
+    printf("Options:\n");
+    printf("  -h          Print this help message.\n");
+    printf("  -s <s>      Number of set index bits (default 5)\n");
+    printf("  -E <E>      Associativity (default 1)\n");
+    printf("  -b <b>      Number of block bits (default 5)\n");
+    printf("  -M <rows>   Number of matrix rows (max %d)\n", TRACER_MAXN);
+    printf("  -N <cols>   Number of matrix columns (max %d)\n", TRACER_MAXN);
+    printf("  -w          Remember the best tiling in %s\n", PLANS_FILE);
+    printf("Example: %s -M 48 -N 48 -w\n", argv[0]);
+}
+
+int main(int argc, char* argv[])
+{
+    int c, tried = 0;
+
+    while ((c = getopt(argc, argv, "hws:E:b:M:N:")) != -1) {
+        switch (c) {
+        case 's': s = atoi(optarg); break;
+        case 'E': E = atoi(optarg); break;
+        case 'b': b = atoi(optarg); break;
+        case 'M': M = atoi(optarg); break;
+        case 'N': N = atoi(optarg); break;
+        case 'w': write_plan = 1; break;
+        case 'h':
+            usage(argv);
+            exit(0);
+        default:
+            usage(argv);
+            exit(1);
+        }
+    }
+    if (M < 1 || N < 1 || M > TRACER_MAXN || N > TRACER_MAXN || s < 0 || s > 30 || E < 1 ||
+        b < 0 || s + b > 63) {
+        printf("Error: Missing or bad argument\n");
+        usage(argv);
+        exit(1);
+    }
+
+    if (!(mat = tracer_matrices())) {
+        printf("Error: out of memory\n");
+        exit(1);
+    }
+
+    /* Candidates have to beat the current plan, ties keep it */
+    TransPlan best = transpose_plan(s, E, b, M, N);
+    long long best_misses = simulate_plan(&best);
+    printf("current: %dx%d %s, %lld misses\n", best.rows, best.cols,
+           transDiagNames[best.diag], best_misses);
+    if (best_misses < 0)
+        best_misses = LLONG_MAX;
+
+    /* Every tile up to TRANS_MAX_TILE a side that fits the matrix; improvements are printed */
+    printf("%5s %5s %7s %10s\n", "rows", "cols", "diag", "misses");
+    for (int rows=1; rows<=TRANS_MAX_TILE && rows<=N; rows++) {
+        for (int cols=1; cols<=TRANS_MAX_TILE && cols<=M; cols++) {
+            for (int d=0; d<NDIAGS; d++) {
+                TransPlan cand = {s, E, b, M, N, rows, cols, d};
+                long long misses = simulate_plan(&cand);
+                tried++;
+                if (misses >= 0 && misses < best_misses) {
+                    best = cand;
+                    best_misses = misses;
+                    printf("%5d %5d %7s %10lld\n", cand.rows, cand.cols,
+                           transDiagNames[d], misses);
+                }
+            }
+        }
+    }
+    printf("best of %d tilings: %dx%d %s, %lld misses\n", tried, best.rows, best.cols,
+           transDiagNames[best.diag], best_misses);
+
+    if (write_plan) {
+        if (remember(&best, best_misses) < 0) {
+            printf("Error: could not update %s\n", PLANS_FILE);
+            exit(1);
+        }
+        printf("Saved to %s; run make to build it into trans.c\n", PLANS_FILE);
+    }
+    free(mat);
+    return 0;
+}